@@ -0,0 +1,278 @@
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_font.h>
+#include <allegro5/allegro_primitives.h>
+
+#include "tgui2.hpp"
+#include "tgui2_widgets.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Headless micro benchmark: creates a lot of tiny widgets (like markers in
+// an editor) and times picking and focus search over them, then times
+// relayout of a big splitter tree, serial and parallel, and drawing a
+// million row list. It also fails (exit status 1) if steady frames
+// allocate; with --check it only does that, for ctest. Time a release
+// build: debug builds check the bounds cache on every pick.
+
+static const int NUM_MARKERS = 100000;
+static const int NUM_PICKS = 1000;
+static const int NUM_COLUMNS = 64;
+static const int NUM_ROWS = 256;
+static const int LAYOUT_THREADS = 4;
+static const int NUM_STEADY_FRAMES = 100;
+static const int NUM_LIST_ROWS = 1000000;
+static const int NUM_LIST_FRAMES = 100;
+
+static int steadyAllocations = 0;
+
+static void countSteadyAllocation(size_t bytes, int phase)
+{
+	(void)bytes;
+	(void)phase;
+	steadyAllocations++;
+}
+
+class Marker : public TGUI_Extended_Widget {
+public:
+	bool acceptsFocus() { return true; }
+
+	Marker(int x, int y)
+	{
+		this->x = x;
+		this->y = y;
+		width = 4;
+		height = 4;
+		setPositionsChildren(false);
+	}
+};
+
+// Rows made up as they're asked for. The text isn't NUL-terminated, like
+// text pointing into the middle of the app's own buffer.
+class RowProvider : public TGUI_ListProvider {
+public:
+	int getCount() { return NUM_LIST_ROWS; }
+
+	const char *getText(int index, int *length)
+	{
+		fetched++;
+		*length = sprintf(buf, "Row %d", index);
+		buf[*length] = '#';
+		return buf;
+	}
+
+	RowProvider() : fetched(0) {}
+
+	int fetched;
+
+protected:
+	char buf[32];
+};
+
+// Time to lay out NUM_COLUMNS splitters of NUM_ROWS markers after the
+// root splitter is resized. Each column also has a wrapping text area,
+// so a widget that measures text is resized by the layout.
+static double timeLayout(int threads)
+{
+	tgui::init(NULL);
+	tgui::setScreenSize(4096, 4096);
+	ALLEGRO_FONT *font = al_create_builtin_font();
+	tgui::setFont(font);
+	tgui::setLayoutThreads(threads);
+
+	std::vector<tgui::TGUIWidget *> columns;
+	for (int i = 0; i < NUM_COLUMNS; i++) {
+		std::vector<tgui::TGUIWidget *> rows;
+		TGUI_TextArea *text = new TGUI_TextArea("Some text that is wrapped to the width of its column", 0, 0, 64, 16);
+		text->setWrap(true);
+		rows.push_back(text);
+		for (int j = 1; j < NUM_ROWS; j++) {
+			rows.push_back(new Marker(0, 0));
+		}
+		columns.push_back(new TGUI_Splitter(0, 0, 64, 4096, TGUI_VERTICAL, true, rows));
+	}
+	TGUI_Splitter *root = new TGUI_Splitter(0, 0, 4096, 4096, TGUI_HORIZONTAL, true, columns);
+	tgui::addWidget(root);
+	tgui::updateLayout();
+
+	double start = al_get_time();
+	root->setHeight(2048);
+	tgui::updateLayout();
+	// text areas wrap again here, on this thread
+	tgui::update();
+	double time = al_get_time() - start;
+
+	tgui::shutdown();
+	al_destroy_font(font);
+
+	return time;
+}
+
+// Frames of the built-in widgets with the pointer moving, drawn to a
+// memory bitmap, under the allocation check after the first few (which
+// warm the caches). Counts into steadyAllocations.
+static void countSteadyFrameAllocations()
+{
+	al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+	ALLEGRO_BITMAP *target = al_create_bitmap(640, 480);
+	al_set_target_bitmap(target);
+	ALLEGRO_FONT *font = al_create_builtin_font();
+
+	tgui::init(NULL);
+	tgui::setScreenSize(640, 480);
+	tgui::setFont(font);
+
+	ALLEGRO_COLOR black = al_map_rgb(0x00, 0x00, 0x00);
+	tgui::addWidget(new TGUI_Button("Button", 10, 10, 80, 20));
+	tgui::addWidget(new TGUI_Label("A label", black, 10, 40, 0));
+	TGUI_Label *wrapped = new TGUI_Label("A label wrapped to a width, over more than one line", black, 10, 60, 0);
+	wrapped->setWrapWidth(100);
+	tgui::addWidget(wrapped);
+	TGUI_TextField *field = new TGUI_TextField("A text field", 10, 150, 100);
+	tgui::addWidget(field);
+	TGUI_List *list = new TGUI_List(200, 10, 100);
+	list->setLabels(std::vector<std::string>(50, "A list row"));
+	tgui::addWidget(list);
+	TGUI_TextArea *area = new TGUI_TextArea("A text area\nwith a few lines\nin a scroll pane\n", 0, 0, 200, 100);
+	TGUI_ScrollPane *pane = new TGUI_ScrollPane(area);
+	pane->setX(350);
+	pane->setY(10);
+	pane->setWidth(200);
+	pane->setHeight(60);
+	tgui::addWidget(pane);
+	tgui::setFocus(field);
+
+	for (int i = 0; i < 3 + NUM_STEADY_FRAMES; i++) {
+		if (i == 3) {
+			tgui::setAllegroAllocationCounting(true);
+			tgui::resetAllocationStats();
+			tgui::setAllocationCheck(true, countSteadyAllocation);
+		}
+		ALLEGRO_EVENT event;
+		memset(&event, 0, sizeof(event));
+		event.type = ALLEGRO_EVENT_MOUSE_AXES;
+		event.mouse.x = rand() % 640;
+		event.mouse.y = rand() % 480;
+		tgui::handleEvent(&event);
+		tgui::update();
+		tgui::draw();
+	}
+	tgui::setAllocationCheck(false);
+	tgui::setAllegroAllocationCounting(false);
+
+	tgui::shutdown();
+	al_destroy_font(font);
+	al_set_target_bitmap(NULL);
+	al_destroy_bitmap(target);
+}
+
+// Frames of a NUM_LIST_ROWS row list in a scroll pane, scrolled half way
+static void timeProviderList()
+{
+	al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+	ALLEGRO_BITMAP *target = al_create_bitmap(640, 480);
+	al_set_target_bitmap(target);
+	ALLEGRO_FONT *font = al_create_builtin_font();
+
+	tgui::init(NULL);
+	tgui::setScreenSize(640, 480);
+	tgui::setFont(font);
+
+	RowProvider rows;
+	TGUI_List *list = new TGUI_List(0, 0, 200);
+	list->setProvider(&rows);
+	TGUI_ScrollPane *pane = new TGUI_ScrollPane(list);
+	pane->setWidth(200);
+	pane->setHeight(400);
+	tgui::addWidget(pane);
+	pane->setValues(0, 0.5f);
+	tgui::draw();
+
+	rows.fetched = 0;
+	double start = al_get_time();
+	for (int i = 0; i < NUM_LIST_FRAMES; i++) {
+		tgui::draw();
+	}
+	double time = al_get_time() - start;
+
+	printf("list %d rows:        %.3f ms/frame (%d rows fetched/frame)\n", NUM_LIST_ROWS, time * 1000 / NUM_LIST_FRAMES, rows.fetched / NUM_LIST_FRAMES);
+
+	tgui::shutdown();
+	al_destroy_font(font);
+	al_set_target_bitmap(NULL);
+	al_destroy_bitmap(target);
+}
+
+int main(int argc, char **argv)
+{
+	al_init();
+	al_init_font_addon();
+	al_init_primitives_addon();
+
+	if (argc > 1 && strcmp(argv[1], "--check") == 0) {
+		countSteadyFrameAllocations();
+		printf("steady frame allocations: %d in %d frames\n", steadyAllocations, NUM_STEADY_FRAMES);
+		return steadyAllocations ? 1 : 0;
+	}
+
+	int num_markers = NUM_MARKERS;
+	if (argc > 1) {
+		num_markers = atoi(argv[1]);
+	}
+
+	tgui::init(NULL);
+	tgui::setScreenSize(4096, 4096);
+
+	srand(0);
+
+	double start = al_get_time();
+	for (int i = 0; i < num_markers; i++) {
+		tgui::addWidget(new Marker(rand() % 4096, rand() % 4096));
+	}
+	double create_time = al_get_time() - start;
+
+	// first pick builds the bounds cache
+	start = al_get_time();
+	tgui::determineTopLevelOwner(0, 0);
+	double cache_time = al_get_time() - start;
+
+	int found = 0;
+	start = al_get_time();
+	for (int i = 0; i < NUM_PICKS; i++) {
+		if (tgui::determineTopLevelOwner(rand() % 4096, rand() % 4096)) {
+			found++;
+		}
+	}
+	double pick_time = al_get_time() - start;
+
+	printf("markers:                 %d\n", num_markers);
+	printf("sizeof(TGUIWidget):      %d\n", (int)sizeof(tgui::TGUIWidget));
+	printf("sizeof(TGUI_Extended_Widget): %d\n", (int)sizeof(TGUI_Extended_Widget));
+	printf("sizeof(Marker):          %d\n", (int)sizeof(Marker));
+	printf("sizeof(TGUI_Button):     %d\n", (int)sizeof(TGUI_Button));
+	printf("sizeof(TGUI_Label):      %d\n", (int)sizeof(TGUI_Label));
+	printf("per-widget overhead:     %d\n", tgui::getPerWidgetOverhead());
+	printf("per-marker footprint:    %d\n", (int)sizeof(Marker) + tgui::getPerWidgetOverhead());
+	printf("total marker footprint:  %.2f MB\n", (sizeof(Marker) + tgui::getPerWidgetOverhead()) * (double)num_markers / (1024*1024));
+	printf("create:                  %.3f ms\n", create_time * 1000);
+	printf("build bounds cache:      %.3f ms\n", cache_time * 1000);
+	printf("pick:                    %.3f us/pick (%d hits)\n", pick_time * 1000000 / NUM_PICKS, found);
+
+	tgui::shutdown();
+
+	countSteadyFrameAllocations();
+	printf("steady frame allocations: %d in %d frames\n", steadyAllocations, NUM_STEADY_FRAMES);
+
+	double serial_time = timeLayout(0);
+	double parallel_time = timeLayout(LAYOUT_THREADS);
+
+	printf("layout %d nodes:       %.3f ms\n", NUM_COLUMNS * (NUM_ROWS+1), serial_time * 1000);
+	printf("layout, %d threads:     %.3f ms\n", LAYOUT_THREADS, parallel_time * 1000);
+
+	timeProviderList();
+
+	return steadyAllocations ? 1 : 0;
+}
@@ -41,6 +41,7 @@ public:
 			downY = abs_y;
 			x += dx;
 			y += dy;
+			tgui::invalidateBounds();
 		}
 	}
 
@@ -48,12 +49,14 @@ public:
 	{
 		width = w;
 		height = h;
+		tgui::invalidateBounds();
 	}
 
 	void setPosition(int x, int y)
 	{
 		this->x = x;
 		this->y = y;
+		tgui::invalidateBounds();
 	}
 
 	ExFrame(ALLEGRO_COLOR color) :
@@ -90,7 +93,7 @@ public:
 			exit(0);
 	}
 
-	ExButton(std::string text, ALLEGRO_COLOR color) :
+	ExButton(const std::string &text, ALLEGRO_COLOR color) :
 		ExFrame(color)
 	{
 		this->text = text;
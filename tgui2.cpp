@@ -1,19 +1,88 @@
 #define ALLEGRO_STATICLINK
 
 #include "tgui2.hpp"
+#include "tgui2_text.hpp"
 
 #include <allegro5/allegro_primitives.h>
 
+#include <cassert>
 #include <cstdio>
+#include <cstdlib>
 #include <cmath>
 
+#if defined __AVX2__
+#define TGUI_AVX2
+#include <immintrin.h>
+#elif defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#define TGUI_SSE2
+#include <emmintrin.h>
+#endif
+
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
+#if defined _MSC_VER
+#define TGUI_THREAD_LOCAL __declspec(thread)
+#else
+#define TGUI_THREAD_LOCAL __thread
+#endif
+
 namespace tgui {
 
+	// Absolute bounds of a layer's widgets, in the same order as
+	// TGUI::widgets. x2/y2 are x1+width/y1+height.
+	struct TGUIBounds {
+		std::vector<int> x1;
+		std::vector<int> y1;
+		std::vector<int> x2;
+		std::vector<int> y2;
+		bool dirty;
+	};
+
 	struct TGUI {
 		std::vector<TGUIWidget*> widgets;
 		bool hidden;
+		TGUIBounds bounds;
+		// widgets that can position other widgets (see
+		// TGUIWidget::getPositionsChildren), in TGUI::widgets order
+		std::vector<TGUIWidget*> positioners;
+		bool positionersDirty;
+		// view transform: widgets are drawn at position*view_scale +
+		// view_x/y, the pointer is mapped back before hit testing
+		float view_x;
+		float view_y;
+		float view_scale;
+	};
+
+	struct TGUIWidgetSlot {
+		TGUIWidget *widget;
+		unsigned int generation;
+	};
+
+	// Per-widget state that's rarely touched, kept out of TGUIWidget
+	struct TGUIWidgetColdState {
+		int focusGroup;
+		int numberInFocusGroup;
+		bool layoutPending;
+		bool measurePending;
+	};
+
+	struct TGUIPendingLayout {
+		int depth;
+		TGUIHandle handle;
+	};
+
+	// Worker threads for parallel layout (see setLayoutThreads()). Each
+	// run hands out chunks of jobs until they're gone.
+	struct TGUILayoutPool {
+		std::vector<ALLEGRO_THREAD *> threads;
+		ALLEGRO_MUTEX *mutex;
+		ALLEGRO_COND *start_cond;
+		ALLEGRO_COND *done_cond;
+		const std::vector<TGUIWidget *> *jobs;
+		size_t next_job;
+		unsigned int generation;
+		int running;
+		bool quit;
 	};
 
 }
@@ -23,25 +92,78 @@ static void drawRect(tgui::TGUI *gui, int x1, int y1, int x2, int y2);
 namespace tgui {
 
 static TGUIWidget *getWidgetInDirection(TGUIWidget *widget, int xdir, int ydir);
+static void applyPendingResize();
 
 static ALLEGRO_DISPLAY *display;
 
 static std::vector<TGUI*> stack;
-static std::vector<TGUIWidget *> stackFocus;
+static std::vector<TGUIHandle> stackFocus;
 static double lastUpdate;
 static TGUIWidget* currentParent = 0;
 
 static int screenWidth = 0;
 static int screenHeight = 0;
+// screenWidth/Height are cached for screenSizeDisplay until the display
+// is resized
+static ALLEGRO_DISPLAY *screenSizeDisplay = NULL;
+static bool screenSizeValid = false;
+static bool resizePending = false;
+// size in the last ALLEGRO_EVENT_DISPLAY_RESIZE
+static int resizeWidth;
+static int resizeHeight;
 
 static float x_scale = 1;
 static float y_scale = 1;
 static float x_offset = 0;
 static float y_offset = 0;
+// view scale of the layer being drawn, for setClip
+static float drawViewScale = 1;
 
 static std::vector<TGUIWidget *> focusOrderList;
 static bool focusWrap = false;
-static TGUIWidget *focussedWidget;
+static TGUIHandle focussedWidget;
+
+static std::vector<TGUIWidgetSlot> widgetTable;
+static std::vector<TGUIWidgetColdState> widgetColdState;
+static std::vector<unsigned int> freeWidgetSlots;
+
+// Allocation counting (see countAllocation()). The phase is per thread so
+// layout workers and other threads aren't counted, -1 when not counting.
+static TGUI_THREAD_LOCAL int allocationPhase = -1;
+static unsigned long allocationCount[TGUI_ALLOC_PHASES];
+static unsigned long allocationBytes[TGUI_ALLOC_PHASES];
+static bool allocationCheck = false;
+static void (*allocationHandler)(size_t bytes, int phase) = NULL;
+
+// Counts allocations into phase while in scope, unless an outer call
+// (handleEvent() calling handleEvent_pretransformed()) already is
+class TGUIAllocationScope {
+public:
+	TGUIAllocationScope(int phase) :
+		saved(allocationPhase)
+	{
+		if (saved < 0)
+			allocationPhase = phase;
+	}
+	~TGUIAllocationScope()
+	{
+		allocationPhase = saved;
+	}
+private:
+	int saved;
+};
+
+// Free vectors for TGUIScratchVector
+static std::vector<std::vector<TGUIWidget *> *> scratchPool;
+
+static std::vector<TGUIHandle> pendingLayout;
+static std::vector<TGUIPendingLayout> layoutBatch;
+static std::vector<TGUIWidget *> layoutJobs;
+static TGUILayoutPool layoutPool;
+// true while layout() may be running on worker threads
+static bool parallelLayout = false;
+
+static std::vector<unsigned char> boundsHits;
 
 static ALLEGRO_FONT *font;
 
@@ -67,6 +189,447 @@ static int joyAxisDownXdir;
 static int joyAxisDownYdir;
 static double joyAxisDownTime;
 
+TGUIHandle registerWidget(TGUIWidget *widget)
+{
+	unsigned int index;
+
+	if (freeWidgetSlots.size() > 0) {
+		index = freeWidgetSlots.back();
+		freeWidgetSlots.pop_back();
+	}
+	else {
+		index = widgetTable.size();
+		TGUIWidgetSlot slot;
+		slot.widget = NULL;
+		slot.generation = 1;
+		widgetTable.push_back(slot);
+		widgetColdState.push_back(TGUIWidgetColdState());
+	}
+
+	widgetTable[index].widget = widget;
+	widgetColdState[index].focusGroup = 0;
+	widgetColdState[index].numberInFocusGroup = 0;
+	widgetColdState[index].layoutPending = false;
+	widgetColdState[index].measurePending = false;
+
+	return TGUIHandle(index, widgetTable[index].generation);
+}
+
+void unregisterWidget(TGUIWidget *widget, unsigned int index)
+{
+	assert(index < widgetTable.size() && widgetTable[index].widget == widget);
+	if (index >= widgetTable.size() || widgetTable[index].widget != widget)
+		return;
+
+	TGUIWidgetSlot &slot = widgetTable[index];
+	slot.widget = NULL;
+	slot.generation++;
+	if (slot.generation == 0) // 0 is reserved for null handles
+		slot.generation = 1;
+	freeWidgetSlots.push_back(index);
+}
+
+bool isValid(TGUIHandle handle)
+{
+	return handle.index < widgetTable.size() &&
+		widgetTable[handle.index].generation == handle.generation &&
+		widgetTable[handle.index].widget != NULL;
+}
+
+TGUIWidget *getWidget(TGUIHandle handle)
+{
+	if (!isValid(handle))
+		return NULL;
+	return widgetTable[handle.index].widget;
+}
+
+unsigned int getWidgetTableSize()
+{
+	return widgetTable.size();
+}
+
+// Library bookkeeping per live widget on top of sizeof(the widget class)
+unsigned int getPerWidgetOverhead()
+{
+	return sizeof(TGUIWidgetSlot) +
+		sizeof(TGUIWidgetColdState) +
+		sizeof(TGUIWidget *) + // TGUI::widgets
+		sizeof(int) * 4; // TGUIBounds
+}
+
+TGUIScratchVector::TGUIScratchVector()
+{
+	if (scratchPool.empty()) {
+		v = new std::vector<TGUIWidget *>;
+		countAllocation(sizeof(*v));
+	}
+	else {
+		v = scratchPool.back();
+		scratchPool.pop_back();
+	}
+	capacity = v->capacity();
+}
+
+TGUIScratchVector::~TGUIScratchVector()
+{
+	countGrowth(*v, capacity);
+	v->clear();
+	size_t poolCapacity = scratchPool.capacity();
+	scratchPool.push_back(v);
+	countGrowth(scratchPool, poolCapacity);
+}
+
+static const char *allocationPhaseNames[TGUI_ALLOC_PHASES] = {
+	"handleEvent", "update", "draw"
+};
+
+void countAllocation(size_t bytes)
+{
+	int phase = allocationPhase;
+	if (phase < 0)
+		return;
+
+	allocationCount[phase]++;
+	allocationBytes[phase] += bytes;
+
+	if (allocationCheck) {
+		// the handler and stdio may allocate too
+		allocationPhase = -1;
+		if (allocationHandler) {
+			allocationHandler(bytes, phase);
+		}
+		else {
+			fprintf(stderr, "tgui: %d bytes allocated in %s with the allocation check on\n", (int)bytes, allocationPhaseNames[phase]);
+			abort();
+		}
+		allocationPhase = phase;
+	}
+}
+
+void getAllocationStats(int phase, unsigned long *count, unsigned long *bytes)
+{
+	*count = allocationCount[phase];
+	*bytes = allocationBytes[phase];
+}
+
+void resetAllocationStats()
+{
+	for (int i = 0; i < TGUI_ALLOC_PHASES; i++) {
+		allocationCount[i] = 0;
+		allocationBytes[i] = 0;
+	}
+}
+
+void setAllocationCheck(bool check, void (*handler)(size_t bytes, int phase))
+{
+	allocationCheck = check;
+	allocationHandler = handler;
+}
+
+// The app's memory interface the counted one passes calls on to, NULL
+// for the C library
+static ALLEGRO_MEMORY_INTERFACE *appMemoryInterface = NULL;
+
+static void *countedMalloc(size_t n, int line, const char *file, const char *func)
+{
+	countAllocation(n);
+	if (appMemoryInterface)
+		return appMemoryInterface->mi_malloc(n, line, file, func);
+	return malloc(n);
+}
+
+static void countedFree(void *ptr, int line, const char *file, const char *func)
+{
+	if (appMemoryInterface) {
+		appMemoryInterface->mi_free(ptr, line, file, func);
+		return;
+	}
+	free(ptr);
+}
+
+static void *countedRealloc(void *ptr, size_t n, int line, const char *file, const char *func)
+{
+	if (n > 0)
+		countAllocation(n);
+	if (appMemoryInterface)
+		return appMemoryInterface->mi_realloc(ptr, n, line, file, func);
+	return realloc(ptr, n);
+}
+
+static void *countedCalloc(size_t count, size_t n, int line, const char *file, const char *func)
+{
+	countAllocation(count * n);
+	if (appMemoryInterface)
+		return appMemoryInterface->mi_calloc(count, n, line, file, func);
+	return calloc(count, n);
+}
+
+static ALLEGRO_MEMORY_INTERFACE countedMemoryInterface = {
+	countedMalloc,
+	countedFree,
+	countedRealloc,
+	countedCalloc
+};
+
+void setAllegroAllocationCounting(bool count, ALLEGRO_MEMORY_INTERFACE *app)
+{
+	appMemoryInterface = app;
+	al_set_memory_interface(count ? &countedMemoryInterface : app);
+}
+
+TGUIHandle TGUIWidget::getHandle()
+{
+	return TGUIHandle(handleIndex, widgetTable[handleIndex].generation);
+}
+
+void TGUIWidget::setPositionsChildren(bool positions)
+{
+	positionsChildren = positions;
+	for (size_t i = 0; i < stack.size(); i++) {
+		stack[i]->positionersDirty = true;
+		stack[i]->bounds.dirty = true;
+	}
+}
+
+void TGUIWidget::invalidateLayout()
+{
+	if (widgetColdState[handleIndex].layoutPending)
+		return;
+
+	widgetColdState[handleIndex].layoutPending = true;
+	if (parallelLayout) {
+		al_lock_mutex(layoutPool.mutex);
+		pendingLayout.push_back(getHandle());
+		al_unlock_mutex(layoutPool.mutex);
+	}
+	else {
+		size_t capacity = pendingLayout.capacity();
+		pendingLayout.push_back(getHandle());
+		countGrowth(pendingLayout, capacity);
+	}
+}
+
+void TGUIWidget::invalidateMeasure()
+{
+	widgetColdState[handleIndex].measurePending = true;
+	if (parent) {
+		parent->invalidateLayout();
+	}
+}
+
+bool TGUIWidget::takeMeasurePending()
+{
+	bool pending = widgetColdState[handleIndex].measurePending;
+	widgetColdState[handleIndex].measurePending = false;
+	return pending;
+}
+
+static bool pendingLayoutLess(const TGUIPendingLayout &a, const TGUIPendingLayout &b)
+{
+	return a.depth < b.depth;
+}
+
+// Fewer dirty widgets than this at one depth aren't worth waking the pool
+static const size_t MIN_PARALLEL_LAYOUTS = 64;
+static const size_t LAYOUT_CHUNK = 16;
+
+static void runLayoutJobs()
+{
+	while (true) {
+		al_lock_mutex(layoutPool.mutex);
+		size_t start = layoutPool.next_job;
+		size_t end = MIN(start + LAYOUT_CHUNK, layoutPool.jobs->size());
+		layoutPool.next_job = end;
+		al_unlock_mutex(layoutPool.mutex);
+
+		if (start >= end)
+			return;
+
+		for (size_t i = start; i < end; i++) {
+			(*layoutPool.jobs)[i]->layout();
+		}
+	}
+}
+
+static void *layoutWorker(ALLEGRO_THREAD *thread, void *arg)
+{
+	(void)thread;
+	(void)arg;
+
+	// setLayoutThreads() starts the count at 0 (the thread may not start
+	// running until after the first run is handed out)
+	unsigned int generation = 0;
+
+	al_lock_mutex(layoutPool.mutex);
+	while (true) {
+		while (!layoutPool.quit && layoutPool.generation == generation) {
+			al_wait_cond(layoutPool.start_cond, layoutPool.mutex);
+		}
+		if (layoutPool.quit)
+			break;
+		generation = layoutPool.generation;
+		al_unlock_mutex(layoutPool.mutex);
+
+		runLayoutJobs();
+
+		al_lock_mutex(layoutPool.mutex);
+		if (--layoutPool.running == 0) {
+			al_signal_cond(layoutPool.done_cond);
+		}
+	}
+	al_unlock_mutex(layoutPool.mutex);
+
+	return NULL;
+}
+
+// Lays out jobs on the pool and the calling thread, returns when all are done
+static void layoutInParallel(const std::vector<TGUIWidget *> &jobs)
+{
+	al_lock_mutex(layoutPool.mutex);
+	layoutPool.jobs = &jobs;
+	layoutPool.next_job = 0;
+	layoutPool.running = layoutPool.threads.size();
+	layoutPool.generation++;
+	parallelLayout = true;
+	al_broadcast_cond(layoutPool.start_cond);
+	al_unlock_mutex(layoutPool.mutex);
+
+	runLayoutJobs();
+
+	al_lock_mutex(layoutPool.mutex);
+	while (layoutPool.running > 0) {
+		al_wait_cond(layoutPool.done_cond, layoutPool.mutex);
+	}
+	parallelLayout = false;
+	layoutPool.jobs = NULL;
+	al_unlock_mutex(layoutPool.mutex);
+
+	// invalidateBounds() does nothing on workers
+	invalidateBounds();
+}
+
+static void stopLayoutThreads()
+{
+	if (!layoutPool.mutex)
+		return;
+
+	al_lock_mutex(layoutPool.mutex);
+	layoutPool.quit = true;
+	al_broadcast_cond(layoutPool.start_cond);
+	al_unlock_mutex(layoutPool.mutex);
+
+	for (size_t i = 0; i < layoutPool.threads.size(); i++) {
+		al_join_thread(layoutPool.threads[i], NULL);
+		al_destroy_thread(layoutPool.threads[i]);
+	}
+	layoutPool.threads.clear();
+
+	al_destroy_cond(layoutPool.start_cond);
+	al_destroy_cond(layoutPool.done_cond);
+	al_destroy_mutex(layoutPool.mutex);
+	layoutPool.mutex = NULL;
+}
+
+void setLayoutThreads(int count)
+{
+	stopLayoutThreads();
+
+	if (count <= 1)
+		return;
+
+	layoutPool.mutex = al_create_mutex();
+	layoutPool.start_cond = al_create_cond();
+	layoutPool.done_cond = al_create_cond();
+	layoutPool.jobs = NULL;
+	layoutPool.generation = 0;
+	layoutPool.running = 0;
+	layoutPool.quit = false;
+
+	// The thread calling updateLayout() is one of them
+	for (int i = 0; i < count-1; i++) {
+		ALLEGRO_THREAD *thread = al_create_thread(layoutWorker, NULL);
+		if (!thread)
+			break;
+		layoutPool.threads.push_back(thread);
+		al_start_thread(thread);
+	}
+}
+
+void updateLayout()
+{
+	// layout() can dirty more widgets (children whose size changed), so
+	// keep going until nothing is pending
+	while (pendingLayout.size() > 0) {
+		std::vector<TGUIPendingLayout> &batch = layoutBatch;
+		size_t batchCapacity = batch.capacity();
+		batch.clear();
+		for (size_t i = 0; i < pendingLayout.size(); i++) {
+			TGUIWidget *w = getWidget(pendingLayout[i]);
+			if (!w)
+				continue;
+			TGUIPendingLayout p;
+			p.depth = 0;
+			p.handle = pendingLayout[i];
+			while ((w = w->getParent()) != NULL) {
+				p.depth++;
+			}
+			batch.push_back(p);
+		}
+		pendingLayout.clear();
+		countGrowth(batch, batchCapacity);
+
+		// Outermost first, so a container sizes its children before
+		// they lay themselves out. Order within a depth doesn't matter
+		// (see below), and std::sort needs no temporary buffer.
+		std::sort(batch.begin(), batch.end(), pendingLayoutLess);
+
+		size_t i = 0;
+		while (i < batch.size()) {
+			int depth = batch[i].depth;
+
+			// Widgets at the same depth can't contain each other, so
+			// their subtrees are independent and can be laid out in
+			// any order
+			size_t jobsCapacity = layoutJobs.capacity();
+			layoutJobs.clear();
+			for (; i < batch.size() && batch[i].depth == depth; i++) {
+				TGUIWidget *w = getWidget(batch[i].handle);
+				if (!w || !widgetColdState[batch[i].handle.index].layoutPending)
+					continue;
+				widgetColdState[batch[i].handle.index].layoutPending = false;
+				w->prepareLayout();
+				layoutJobs.push_back(w);
+			}
+			countGrowth(layoutJobs, jobsCapacity);
+
+			if (layoutPool.threads.size() > 0 && layoutJobs.size() >= MIN_PARALLEL_LAYOUTS) {
+				layoutInParallel(layoutJobs);
+			}
+			else {
+				for (size_t j = 0; j < layoutJobs.size(); j++) {
+					layoutJobs[j]->layout();
+				}
+			}
+		}
+	}
+}
+
+void TGUIWidget::setFocusGroup(int focusGroup, int numberInFocusGroup)
+{
+	widgetColdState[handleIndex].focusGroup = focusGroup;
+	widgetColdState[handleIndex].numberInFocusGroup = numberInFocusGroup;
+}
+
+int TGUIWidget::getFocusGroup()
+{
+	return widgetColdState[handleIndex].focusGroup;
+}
+
+int TGUIWidget::getNumberInFocusGroup()
+{
+	return widgetColdState[handleIndex].numberInFocusGroup;
+}
+
 bool checkBoxCollision(int x1, int y1, int x2, int y2, int x3, int y3, int x4, int y4)
 {
 	if ((y2 < y3) || (y1 > y4) || (x2 < x3) || (x1 > x4))
@@ -74,6 +637,243 @@ bool checkBoxCollision(int x1, int y1, int x2, int y2, int x3, int y3, int x4, i
 	return true;
 }
 
+#if defined TGUI_AVX2
+static const int BOX_LANES = 8;
+#elif defined TGUI_SSE2
+static const int BOX_LANES = 4;
+#else
+static const int BOX_LANES = 1;
+#endif
+
+int findBoxContainingPoint(const int *x1, const int *y1, const int *x2, const int *y2, int count, int x, int y)
+{
+	int i = count;
+
+	// Scalar tail so the vector loop only sees whole blocks
+	while (i % BOX_LANES) {
+		i--;
+		if (x >= x1[i] && y >= y1[i] && x < x2[i] && y < y2[i]) {
+			return i;
+		}
+	}
+
+#if defined TGUI_AVX2
+	__m256i px = _mm256_set1_epi32(x);
+	__m256i py = _mm256_set1_epi32(y);
+	while (i > 0) {
+		i -= BOX_LANES;
+		__m256i bx1 = _mm256_loadu_si256((const __m256i *)(x1+i));
+		__m256i by1 = _mm256_loadu_si256((const __m256i *)(y1+i));
+		__m256i bx2 = _mm256_loadu_si256((const __m256i *)(x2+i));
+		__m256i by2 = _mm256_loadu_si256((const __m256i *)(y2+i));
+		__m256i inside = _mm256_andnot_si256(
+			_mm256_or_si256(_mm256_cmpgt_epi32(bx1, px), _mm256_cmpgt_epi32(by1, py)),
+			_mm256_and_si256(_mm256_cmpgt_epi32(bx2, px), _mm256_cmpgt_epi32(by2, py))
+		);
+		int bits = _mm256_movemask_ps(_mm256_castsi256_ps(inside));
+		for (int j = BOX_LANES-1; bits && j >= 0; j--) {
+			if (bits & (1 << j)) {
+				return i + j;
+			}
+		}
+	}
+#elif defined TGUI_SSE2
+	__m128i px = _mm_set1_epi32(x);
+	__m128i py = _mm_set1_epi32(y);
+	while (i > 0) {
+		i -= BOX_LANES;
+		__m128i bx1 = _mm_loadu_si128((const __m128i *)(x1+i));
+		__m128i by1 = _mm_loadu_si128((const __m128i *)(y1+i));
+		__m128i bx2 = _mm_loadu_si128((const __m128i *)(x2+i));
+		__m128i by2 = _mm_loadu_si128((const __m128i *)(y2+i));
+		__m128i inside = _mm_andnot_si128(
+			_mm_or_si128(_mm_cmpgt_epi32(bx1, px), _mm_cmpgt_epi32(by1, py)),
+			_mm_and_si128(_mm_cmpgt_epi32(bx2, px), _mm_cmpgt_epi32(by2, py))
+		);
+		int bits = _mm_movemask_ps(_mm_castsi128_ps(inside));
+		for (int j = BOX_LANES-1; bits && j >= 0; j--) {
+			if (bits & (1 << j)) {
+				return i + j;
+			}
+		}
+	}
+#else
+	while (i > 0) {
+		i--;
+		if (x >= x1[i] && y >= y1[i] && x < x2[i] && y < y2[i]) {
+			return i;
+		}
+	}
+#endif
+
+	return -1;
+}
+
+int checkBoxCollisions(const int *x1, const int *y1, const int *x2, const int *y2, int count, int rx1, int ry1, int rx2, int ry2, unsigned char *result)
+{
+	int hits = 0;
+	int i = 0;
+
+#if defined TGUI_AVX2
+	__m256i qx1 = _mm256_set1_epi32(rx1);
+	__m256i qy1 = _mm256_set1_epi32(ry1);
+	__m256i qx2 = _mm256_set1_epi32(rx2);
+	__m256i qy2 = _mm256_set1_epi32(ry2);
+	for (; i+BOX_LANES <= count; i += BOX_LANES) {
+		__m256i bx1 = _mm256_loadu_si256((const __m256i *)(x1+i));
+		__m256i by1 = _mm256_loadu_si256((const __m256i *)(y1+i));
+		__m256i bx2 = _mm256_loadu_si256((const __m256i *)(x2+i));
+		__m256i by2 = _mm256_loadu_si256((const __m256i *)(y2+i));
+		__m256i apart = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpgt_epi32(by1, qy2), _mm256_cmpgt_epi32(qy1, by2)),
+			_mm256_or_si256(_mm256_cmpgt_epi32(bx1, qx2), _mm256_cmpgt_epi32(qx1, bx2))
+		);
+		int bits = ~_mm256_movemask_ps(_mm256_castsi256_ps(apart));
+		for (int j = 0; j < BOX_LANES; j++) {
+			result[i+j] = (bits >> j) & 1;
+			hits += result[i+j];
+		}
+	}
+#elif defined TGUI_SSE2
+	__m128i qx1 = _mm_set1_epi32(rx1);
+	__m128i qy1 = _mm_set1_epi32(ry1);
+	__m128i qx2 = _mm_set1_epi32(rx2);
+	__m128i qy2 = _mm_set1_epi32(ry2);
+	for (; i+BOX_LANES <= count; i += BOX_LANES) {
+		__m128i bx1 = _mm_loadu_si128((const __m128i *)(x1+i));
+		__m128i by1 = _mm_loadu_si128((const __m128i *)(y1+i));
+		__m128i bx2 = _mm_loadu_si128((const __m128i *)(x2+i));
+		__m128i by2 = _mm_loadu_si128((const __m128i *)(y2+i));
+		__m128i apart = _mm_or_si128(
+			_mm_or_si128(_mm_cmpgt_epi32(by1, qy2), _mm_cmpgt_epi32(qy1, by2)),
+			_mm_or_si128(_mm_cmpgt_epi32(bx1, qx2), _mm_cmpgt_epi32(qx1, bx2))
+		);
+		int bits = ~_mm_movemask_ps(_mm_castsi128_ps(apart));
+		for (int j = 0; j < BOX_LANES; j++) {
+			result[i+j] = (bits >> j) & 1;
+			hits += result[i+j];
+		}
+	}
+#endif
+
+	for (; i < count; i++) {
+		result[i] = checkBoxCollision(rx1, ry1, rx2, ry2, x1[i], y1[i], x2[i], y2[i]);
+		hits += result[i];
+	}
+
+	return hits;
+}
+
+void invalidateBounds()
+{
+	// layoutInParallel() invalidates once at the end instead
+	if (parallelLayout)
+		return;
+
+	if (stack.size() > 0) {
+		stack[0]->bounds.dirty = true;
+	}
+}
+
+// Called when the widget list of stack[0] changes
+static void invalidatePositioners()
+{
+	stack[0]->positionersDirty = true;
+	stack[0]->bounds.dirty = true;
+}
+
+static void updatePositioners(TGUI *gui)
+{
+	if (!gui->positionersDirty)
+		return;
+
+	size_t capacity = gui->positioners.capacity();
+	gui->positioners.clear();
+	for (size_t i = 0; i < gui->widgets.size(); i++) {
+		if (gui->widgets[i]->getPositionsChildren()) {
+			gui->positioners.push_back(gui->widgets[i]);
+		}
+	}
+	countGrowth(gui->positioners, capacity);
+
+	gui->positionersDirty = false;
+}
+
+#ifndef NDEBUG
+// A widget that moves or resizes itself by writing x/y/width/height
+// without calling invalidateBounds() would be hit-tested where it was.
+// Debug builds compare the cache with where widgets really are (O(n) per
+// query) and stop at the first that's out of date.
+static void checkBounds(TGUI *gui)
+{
+	TGUIBounds &b = gui->bounds;
+
+	for (size_t i = 0; i < gui->widgets.size(); i++) {
+		TGUIWidget *w = gui->widgets[i];
+		int wx, wy;
+		determineAbsolutePosition(w, &wx, &wy);
+		int wx2 = wx + w->getWidth();
+		int wy2 = wy + w->getHeight();
+		if (b.x1[i] != wx || b.y1[i] != wy || b.x2[i] != wx2 || b.y2[i] != wy2) {
+			fprintf(stderr, "tgui: widget %p moved or resized without tgui::invalidateBounds()\n", (void *)w);
+			assert(!"widget bounds out of date");
+			return;
+		}
+	}
+}
+#endif
+
+// Only valid for stack[0] since that's what determineAbsolutePosition uses
+static void updateBounds(TGUI *gui)
+{
+	TGUIBounds &b = gui->bounds;
+
+	if (!b.dirty) {
+#ifndef NDEBUG
+		checkBounds(gui);
+#endif
+		return;
+	}
+
+	size_t n = gui->widgets.size();
+	size_t capacity = b.x1.capacity();
+	b.x1.resize(n);
+	b.y1.resize(n);
+	b.x2.resize(n);
+	b.y2.resize(n);
+	if (b.x1.capacity() > capacity) {
+		countAllocation(b.x1.capacity() * sizeof(b.x1[0]) * 4);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		TGUIWidget *w = gui->widgets[i];
+		int wx, wy;
+		determineAbsolutePosition(w, &wx, &wy);
+		b.x1[i] = wx;
+		b.y1[i] = wy;
+		b.x2[i] = wx + w->getWidth();
+		b.y2[i] = wy + w->getHeight();
+	}
+
+	b.dirty = false;
+}
+
+// Fills boundsHits for every widget in stack[0] overlapping the box
+static void collideBounds(int x1, int y1, int x2, int y2)
+{
+	TGUI *gui = stack[0];
+	updateBounds(gui);
+
+	int n = gui->widgets.size();
+	size_t capacity = boundsHits.capacity();
+	boundsHits.resize(n);
+	countGrowth(boundsHits, capacity);
+	if (n > 0) {
+		TGUIBounds &b = gui->bounds;
+		checkBoxCollisions(&b.x1[0], &b.y1[0], &b.x2[0], &b.y2[0], n, x1, y1, x2, y2, &boundsHits[0]);
+	}
+}
+
 void setFont(ALLEGRO_FONT *f)
 {
 	font = f;
@@ -124,12 +924,19 @@ void init(ALLEGRO_DISPLAY *d)
 
 	TGUI *gui = new TGUI;
 	gui->hidden = false;
+	gui->bounds.dirty = true;
+	gui->positionersDirty = true;
+	gui->view_x = 0;
+	gui->view_y = 0;
+	gui->view_scale = 1;
 
 	stack.push_back(gui);
-	stackFocus.push_back(NULL);
+	stackFocus.push_back(TGUIHandle());
 
 	lastUpdate = currentTimeMillis();
 
+	screenSizeValid = false;
+	resizePending = false;
 	getScreenSize(&screenWidth, &screenHeight);
 }
 
@@ -138,19 +945,30 @@ void shutdown()
 	deletestack();
 	preDrawWidgets.clear();
 	postDrawWidgets.clear();
+	pendingLayout.clear();
+	stopLayoutThreads();
+	forgetAllFonts();
+	for (size_t i = 0; i < scratchPool.size(); i++) {
+		delete scratchPool[i];
+	}
+	scratchPool.clear();
 }
 
 void setFocus(TGUIWidget *widget)
 {
-	if (widget == NULL || widget->acceptsFocus()) {
-		focussedWidget = widget;
+	if (widget == NULL) {
+		focussedWidget = TGUIHandle();
+	}
+	else if (widget->acceptsFocus()) {
+		focussedWidget = widget->getHandle();
 	}
 }
 
 void setFocusLosingGaining(TGUIWidget *widget)
 {
-	if (focussedWidget) {
-		focussedWidget->losingFocus();
+	TGUIWidget *focussed = getFocussedWidget();
+	if (focussed) {
+		focussed->losingFocus();
 	}
 	if (widget) {
 		widget->gainingFocus();
@@ -160,10 +978,10 @@ void setFocusLosingGaining(TGUIWidget *widget)
 
 TGUIWidget *getFocussedWidget()
 {
-	return focussedWidget;
+	return getWidget(focussedWidget);
 }
 
-void setFocusOrder(std::vector<TGUIWidget *> list)
+void setFocusOrder(const std::vector<TGUIWidget *> &list)
 {
 	focusOrderList = list;
 }
@@ -214,6 +1032,8 @@ void translateAll(int x, int y)
 		TGUIWidget *w = gui->widgets[i];
 		w->translate(x, y);
 	}
+
+	invalidateBounds();
 }
 
 void addWidget(TGUIWidget* widget)
@@ -224,6 +1044,7 @@ void addWidget(TGUIWidget* widget)
 		currentParent->setChild(widget);
 	}
 	stack[0]->widgets.push_back(widget);
+	invalidatePositioners();
 }
 
 static void handleJoyAxisRepeat(int stick, int axis, float value)
@@ -234,16 +1055,17 @@ static void handleJoyAxisRepeat(int stick, int axis, float value)
 			used = used || stack[0]->widgets[i]->chainJoyAxisRepeat(stick, axis, value);
 		}
 	}
-	if (!used && focussedWidget) {
+	TGUIWidget *focussed = getFocussedWidget();
+	if (!used && focussed) {
 		if (axis == 0) {
 			if (value <= -0.5f) {
-				TGUIWidget *w = getWidgetInDirection(focussedWidget, -1, 0);
+				TGUIWidget *w = getWidgetInDirection(focussed, -1, 0);
 				if (w) {
 					setFocusLosingGaining(w);
 				}
 			}
 			else if (value >= 0.5f) {
-				TGUIWidget *w = getWidgetInDirection(focussedWidget, 1, 0);
+				TGUIWidget *w = getWidgetInDirection(focussed, 1, 0);
 				if (w) {
 					setFocusLosingGaining(w);
 				}
@@ -251,13 +1073,13 @@ static void handleJoyAxisRepeat(int stick, int axis, float value)
 		}
 		else {
 			if (value <= -0.5f) {
-				TGUIWidget *w = getWidgetInDirection(focussedWidget, 0, -1);
+				TGUIWidget *w = getWidgetInDirection(focussed, 0, -1);
 				if (w) {
 					setFocusLosingGaining(w);
 				}
 			}
 			else if (value >= 0.5f) {
-				TGUIWidget *w = getWidgetInDirection(focussedWidget, 0, 1);
+				TGUIWidget *w = getWidgetInDirection(focussed, 0, 1);
 				if (w) {
 					setFocusLosingGaining(w);
 				}
@@ -268,6 +1090,11 @@ static void handleJoyAxisRepeat(int stick, int axis, float value)
 
 TGUIWidget *update()
 {
+	TGUIAllocationScope counting(TGUI_ALLOC_UPDATE);
+
+	applyPendingResize();
+	updateLayout();
+
 	long currTime = currentTimeMillis();
 	long elapsed = currTime - lastUpdate;
 	if (elapsed > 50) {
@@ -325,6 +1152,17 @@ TGUIWidget *update()
 std::vector<TGUIWidget *> updateAll()
 {
 	std::vector<TGUIWidget *> retVect;
+	updateAll(retVect);
+	return retVect;
+}
+
+void updateAll(std::vector<TGUIWidget *> &widgets)
+{
+	TGUIAllocationScope counting(TGUI_ALLOC_UPDATE);
+
+	size_t capacity = widgets.capacity();
+	widgets.clear();
+
 	long currTime = currentTimeMillis();
 	long elapsed = currTime - lastUpdate;
 
@@ -338,15 +1176,74 @@ std::vector<TGUIWidget *> updateAll()
 		TGUIWidget *widget = stack[0]->widgets[i];
 		TGUIWidget *retVal = widget->update();
 		if (retVal) {
-			retVect.push_back(retVal);
+			widgets.push_back(retVal);
 		}
 	}
 
-	return retVect;
+	countGrowth(widgets, capacity);
+}
+
+// Puts gui's view transform on top of the current transform, saving the
+// old one in backup. Returns false (and does nothing) for an identity view.
+static bool useView(TGUI *gui, ALLEGRO_TRANSFORM *backup)
+{
+	if (gui->view_x == 0 && gui->view_y == 0 && gui->view_scale == 1)
+		return false;
+
+	al_copy_transform(backup, al_get_current_transform());
+
+	ALLEGRO_TRANSFORM t;
+	al_identity_transform(&t);
+	al_scale_transform(&t, gui->view_scale, gui->view_scale);
+	al_translate_transform(&t, gui->view_x, gui->view_y);
+	al_compose_transform(&t, backup);
+	al_use_transform(&t);
+
+	drawViewScale = gui->view_scale;
+
+	return true;
+}
+
+static void restoreView(const ALLEGRO_TRANSFORM *backup)
+{
+	al_use_transform(backup);
+	drawViewScale = 1;
+}
+
+// Maps a pointer position to gui's widget coordinates
+static void screenToView(TGUI *gui, int *x, int *y)
+{
+	*x = (int)floor((*x - gui->view_x) / gui->view_scale);
+	*y = (int)floor((*y - gui->view_y) / gui->view_scale);
+}
+
+void setView(float x, float y, float scale)
+{
+	stack[0]->view_x = x;
+	stack[0]->view_y = y;
+	stack[0]->view_scale = scale;
+}
+
+void getView(float *x, float *y, float *scale)
+{
+	*x = stack[0]->view_x;
+	*y = stack[0]->view_y;
+	*scale = stack[0]->view_scale;
+}
+
+void translateView(float x, float y)
+{
+	stack[0]->view_x += x;
+	stack[0]->view_y += y;
 }
 
 void draw()
 {
+	TGUIAllocationScope counting(TGUI_ALLOC_DRAW);
+
+	applyPendingResize();
+	updateLayout();
+
 	int abs_x, abs_y;
 
 	for (size_t i = 0; i < preDrawWidgets.size(); i++) {
@@ -358,12 +1255,16 @@ void draw()
 	getScreenSize(&sw, &sh);
 	drawRect(0, 0, sw, sh);
 
+	ALLEGRO_TRANSFORM backup;
+	bool view = useView(stack[0], &backup);
+
 	// Draw focus
-	if (focussedWidget && focussedWidget->getDrawFocus()) {
+	TGUIWidget *focussed = getFocussedWidget();
+	if (focussed && focussed->getDrawFocus()) {
 		int x, y;
-		determineAbsolutePosition(focussedWidget, &x, &y);
-		int w = focussedWidget->getWidth();
-		int h = focussedWidget->getHeight();
+		determineAbsolutePosition(focussed, &x, &y);
+		int w = focussed->getWidth();
+		int h = focussed->getHeight();
 		drawFocusRectangle(x, y, w, h);
 	}
 	
@@ -371,13 +1272,22 @@ void draw()
 		determineAbsolutePosition(postDrawWidgets[i], &abs_x, &abs_y);
 		postDrawWidgets[i]->postDraw(abs_x, abs_y);
 	}
+
+	if (view) {
+		restoreView(&backup);
+	}
 }
 
 void drawRect(int x1, int y1, int x2, int y2)
 {
 	for (int i = stack.size()-1; i >= 0; i--) {
 		if (!stack[i]->hidden) {
+			ALLEGRO_TRANSFORM backup;
+			bool view = useView(stack[i], &backup);
 			::drawRect(stack[i], x1, y1, x2, y2);
+			if (view) {
+				restoreView(&backup);
+			}
 		}
 	}
 }
@@ -386,9 +1296,14 @@ void push()
 {
 	TGUI *gui = new TGUI;
 	gui->hidden = false;
+	gui->bounds.dirty = true;
+	gui->positionersDirty = true;
+	gui->view_x = 0;
+	gui->view_y = 0;
+	gui->view_scale = 1;
 
 	stack.insert(stack.begin(), gui);
-	stackFocus.insert(stackFocus.begin(), getFocussedWidget());
+	stackFocus.insert(stackFocus.begin(), focussedWidget);
 
 	setFocus(NULL);
 }
@@ -401,9 +1316,12 @@ bool pop()
 	deleteGUI(stack[0]);
 	stack.erase(stack.begin());
 
-	setFocus(stackFocus[0]);
+	setFocus(getWidget(stackFocus[0]));
 	stackFocus.erase(stackFocus.begin());
 
+	// Widgets may have moved while the layer was covered
+	invalidateBounds();
+
 	return true;
 }
 
@@ -483,8 +1401,22 @@ void maybe_make_mouse_event(ALLEGRO_EVENT *event)
 
 void handleEvent_pretransformed(void *allegro_event)
 {
+	TGUIAllocationScope counting(TGUI_ALLOC_EVENT);
+
 	ALLEGRO_EVENT *event = (ALLEGRO_EVENT *)allegro_event;
 
+	updateLayout();
+
+	if (event->type == ALLEGRO_EVENT_DISPLAY_RESIZE) {
+		// A resize drag sends many of these. The backbuffer only changes
+		// size once the app acknowledges, so just note it and relayout
+		// once at the next update()/draw()
+		resizePending = true;
+		resizeWidth = event->display.width;
+		resizeHeight = event->display.height;
+		return;
+	}
+
 	if (event->type == ALLEGRO_EVENT_JOYSTICK_AXIS && event->joystick.id && al_get_joystick_num_buttons((ALLEGRO_JOYSTICK *)event->joystick.id) == 0) {
 		return;
 	}
@@ -501,6 +1433,7 @@ void handleEvent_pretransformed(void *allegro_event)
 			int my = event->mouse.y;
 			int mz = event->mouse.z;
 			int mw = event->mouse.w;
+			screenToView(stack[0], &mx, &my);
 			TGUIWidget *w = determineTopLevelOwner(mx, my);
 			if (w) {
 				int rel_x;
@@ -529,6 +1462,7 @@ void handleEvent_pretransformed(void *allegro_event)
 			bool down = event->type == ALLEGRO_EVENT_MOUSE_BUTTON_DOWN;
 			int mx = event->mouse.x;
 			int my = event->mouse.y;
+			screenToView(stack[0], &mx, &my);
 			TGUIWidget *w = determineTopLevelOwner(mx, my);
 			if (w) {
 				int rel_x;
@@ -592,27 +1526,28 @@ void handleEvent_pretransformed(void *allegro_event)
 					used = used || stack[0]->widgets[i]->chainKeyChar(event->keyboard.keycode, event->keyboard.unichar);
 				}
 			}
+			TGUIWidget *focussed = getFocussedWidget();
 			if (!used) {
-				if (focussedWidget && event->keyboard.keycode == ALLEGRO_KEY_LEFT) {
-					TGUIWidget *w = getWidgetInDirection(focussedWidget, -1, 0);
+				if (focussed && event->keyboard.keycode == ALLEGRO_KEY_LEFT) {
+					TGUIWidget *w = getWidgetInDirection(focussed, -1, 0);
 					if (w) {
 						setFocusLosingGaining(w);
 					}
 				}
-				else if (focussedWidget && event->keyboard.keycode == ALLEGRO_KEY_RIGHT) {
-					TGUIWidget *w = getWidgetInDirection(focussedWidget, 1, 0);
+				else if (focussed && event->keyboard.keycode == ALLEGRO_KEY_RIGHT) {
+					TGUIWidget *w = getWidgetInDirection(focussed, 1, 0);
 					if (w) {
 						setFocusLosingGaining(w);
 					}
 				}
-				else if (focussedWidget && event->keyboard.keycode == ALLEGRO_KEY_UP) {
-					TGUIWidget *w = getWidgetInDirection(focussedWidget, 0, -1);
+				else if (focussed && event->keyboard.keycode == ALLEGRO_KEY_UP) {
+					TGUIWidget *w = getWidgetInDirection(focussed, 0, -1);
 					if (w) {
 						setFocusLosingGaining(w);
 					}
 				}
-				else if (focussedWidget && event->keyboard.keycode == ALLEGRO_KEY_DOWN) {
-					TGUIWidget *w = getWidgetInDirection(focussedWidget, 0, 1);
+				else if (focussed && event->keyboard.keycode == ALLEGRO_KEY_DOWN) {
+					TGUIWidget *w = getWidgetInDirection(focussed, 0, 1);
 					if (w) {
 						setFocusLosingGaining(w);
 					}
@@ -702,6 +1637,8 @@ void handleEvent_pretransformed(void *allegro_event)
 
 void handleEvent(void *allegro_event)
 {
+	TGUIAllocationScope counting(TGUI_ALLOC_EVENT);
+
 	ALLEGRO_EVENT *ev = (ALLEGRO_EVENT *)allegro_event;
 	ALLEGRO_EVENT event = *ev;
 
@@ -737,30 +1674,37 @@ TGUIWidget *getTopLevelParent(TGUIWidget *widget)
 
 TGUIWidget *determineTopLevelOwner(int x, int y)
 {
-	if (stack[0]->widgets.size() <= 0)
+	TGUI *gui = stack[0];
+
+	if (gui->widgets.size() <= 0)
 		return NULL;
 
-	for (int i = (int)stack[0]->widgets.size()-1; i >= 0; i--) {
-		TGUIWidget *widget = stack[0]->widgets[i];
-		if (pointOnWidget(widget, x, y)) {
-			TGUIWidget *p = widget;
-			while (p->getParent()) {
-				p = p->getParent();
-			}
-			return p;
-		}
+	updateBounds(gui);
+
+	TGUIBounds &b = gui->bounds;
+	int i = findBoxContainingPoint(&b.x1[0], &b.y1[0], &b.x2[0], &b.y2[0], gui->widgets.size(), x, y);
+	if (i < 0)
+		return NULL;
+
+	TGUIWidget *p = gui->widgets[i];
+	while (p->getParent()) {
+		p = p->getParent();
 	}
-	return NULL;
+	return p;
 }
 
 void determineAbsolutePosition(TGUIWidget *widget, int *x, int *y)
 {
-	// Check each widget in case widget is a child of one
-	for (size_t i = 0; i < stack[0]->widgets.size(); i++) {
-		if (stack[0]->widgets[i] == widget) {
+	TGUI *gui = stack[0];
+	updatePositioners(gui);
+
+	// Check each widget that can position others in case widget is a
+	// child of one
+	for (size_t i = 0; i < gui->positioners.size(); i++) {
+		if (gui->positioners[i] == widget) {
 			continue;
 		}
-		if (stack[0]->widgets[i]->getAbsoluteChildPosition(widget, x, y)) {
+		if (gui->positioners[i]->getAbsoluteChildPosition(widget, x, y)) {
 			return;
 		}
 	}
@@ -768,6 +1712,17 @@ void determineAbsolutePosition(TGUIWidget *widget, int *x, int *y)
 	*y = widget->getY();
 }
 
+bool widgetIsChildOf(TGUIWidget *widget, TGUIWidget *parent)
+{
+	TGUIWidget *p = widget->getParent();
+	while (p) {
+		if (p == parent)
+			return true;
+		p = p->getParent();
+	}
+	return false;
+}
+
 bool pointOnWidget(TGUIWidget *widget, int x, int y)
 {
 	int wx, wy;
@@ -1009,15 +1964,21 @@ void getScreenSize(int *w, int *h)
 		return;
 	}
 
-	if (al_get_current_display()) {
-		ALLEGRO_BITMAP *bb = al_get_backbuffer(al_get_current_display());
+	ALLEGRO_DISPLAY *d = al_get_current_display();
 
-		screenWidth = al_get_bitmap_width(bb);
-		screenHeight = al_get_bitmap_height(bb);
-	}
-	else {
-		screenWidth = -1;
-		screenHeight = -1;
+	if (!screenSizeValid || d != screenSizeDisplay) {
+		if (d) {
+			ALLEGRO_BITMAP *bb = al_get_backbuffer(d);
+
+			screenWidth = al_get_bitmap_width(bb);
+			screenHeight = al_get_bitmap_height(bb);
+		}
+		else {
+			screenWidth = -1;
+			screenHeight = -1;
+		}
+		screenSizeDisplay = d;
+		screenSizeValid = true;
 	}
 	if (w) {
 		*w = screenWidth;
@@ -1027,9 +1988,34 @@ void getScreenSize(int *w, int *h)
 	}
 }
 
+// Applies display resizes seen by handleEvent since the last frame
+static void applyPendingResize()
+{
+	if (!resizePending)
+		return;
+
+	int old_w, old_h, w, h;
+	getScreenSize(&old_w, &old_h);
+	screenSizeValid = false;
+	getScreenSize(&w, &h);
+
+	if (w != old_w || h != old_h) {
+		resize(NULL);
+	}
+
+	// Until the app calls al_acknowledge_resize the backbuffer keeps its
+	// old size, so look again next frame unless this is the size asked
+	// for (or the size is fixed by setScreenSize)
+	if (w != old_w || h != old_h || (w == resizeWidth && h == resizeHeight) || screenSizeOverrideX > 0) {
+		resizePending = false;
+	}
+}
+
 void resize(TGUIWidget *parent)
 {
+	screenSizeValid = false;
 	clearClip();
+	invalidateBounds();
 
 	if (parent) {
 		parent->resize();
@@ -1048,54 +2034,53 @@ bool isClipSet()
 	return clipSet;
 }
 
-void setClip(int x, int y, int width, int height)
+// A rectangle in drawing coordinates as clipping rectangle pixels, like
+// setClip() maps it
+static void clipToPixels(int x, int y, int width, int height, int *px, int *py, int *pw, int *ph)
 {
 	const ALLEGRO_TRANSFORM *t = al_get_current_transform();
 	float tx = t->m[3][0];
 	float ty = t->m[3][1];
 
-	x = x * x_scale;
-	y = y * y_scale;
+	float xs = x_scale * drawViewScale;
+	float ys = y_scale * drawViewScale;
+
+	x = x * xs;
+	y = y * ys;
 
 	x += tx;
 	y += ty;
 
-	al_set_clipping_rectangle(x, y, ceil(width*x_scale), ceil(height*y_scale));
+	*px = x;
+	*py = y;
+	*pw = (int)ceil(width*xs);
+	*ph = (int)ceil(height*ys);
+}
+
+void setClip(int x, int y, int width, int height)
+{
+	int px, py, pw, ph;
+	clipToPixels(x, y, width, height, &px, &py, &pw, &ph);
+	al_set_clipping_rectangle(px, py, pw, ph);
 	clipSet = true;
 }
 
 void setClippedClip(int x, int y, int width, int height)
 {
+	// intersect in pixels, the current clip is in pixels already
+	int px, py, pw, ph;
+	clipToPixels(x, y, width, height, &px, &py, &pw, &ph);
+
 	int curr_x, curr_y, curr_w, curr_h;
 	al_get_clipping_rectangle(&curr_x, &curr_y, &curr_w, &curr_h);
-	if (
-		x >= curr_x+curr_w || x+width <= curr_x ||
-		y >= curr_y+curr_h || y+height <= curr_y
-	) {
-		x = curr_x;
-		y = curr_y;
-		width = curr_w;
-		height = curr_h;
-	}
-	else {
-		if (curr_x > x && curr_x < x+width) {
-			int d = curr_x-x;
-			x += d;
-			width -= d;
-		}
-		if (curr_y > y && curr_y < y+height) {
-			int d = curr_y-y;
-			y += d;
-			height -= d;
-		}
-		if (curr_x+curr_w > x && curr_x+curr_w < x+width) {
-			width -= (x+width)-(curr_x+curr_w);
-		}
-		if (curr_y+curr_h > y && curr_y+curr_h < y+height) {
-			height -= (y+height)-(curr_y+curr_h);
-		}
-	}
-	setClip(x, y, width, height);
+
+	int x1 = std::max(px, curr_x);
+	int y1 = std::max(py, curr_y);
+	int x2 = std::min(px+pw, curr_x+curr_w);
+	int y2 = std::min(py+ph, curr_y+curr_h);
+
+	al_set_clipping_rectangle(x1, y1, std::max(0, x2-x1), std::max(0, y2-y1));
+	clipSet = true;
 }
 
 void clearClip()
@@ -1111,6 +2096,31 @@ void getClip(int *x, int *y, int *w, int *h)
 	al_get_clipping_rectangle(x, y, w, h);
 }
 
+bool getLocalClip(float *x1, float *y1, float *x2, float *y2)
+{
+	const ALLEGRO_TRANSFORM *t = al_get_current_transform();
+	if (t->m[0][1] != 0 || t->m[1][0] != 0)
+		return false;
+
+	int cx, cy, cw, ch;
+	al_get_clipping_rectangle(&cx, &cy, &cw, &ch);
+
+	ALLEGRO_TRANSFORM inverse;
+	al_copy_transform(&inverse, t);
+	al_invert_transform(&inverse);
+
+	float ax = cx, ay = cy, bx = cx+cw, by = cy+ch;
+	al_transform_coordinates(&inverse, &ax, &ay);
+	al_transform_coordinates(&inverse, &bx, &by);
+
+	*x1 = std::min(ax, bx);
+	*y1 = std::min(ay, by);
+	*x2 = std::max(ax, bx);
+	*y2 = std::max(ay, by);
+
+	return true;
+}
+
 bool isDeepChild(TGUIWidget *child, TGUIWidget *parent)
 {
 	TGUIWidget *p = parent;
@@ -1122,45 +2132,32 @@ bool isDeepChild(TGUIWidget *child, TGUIWidget *parent)
 	return false;
 }
 
-std::vector<TGUIWidget *> findChildren(TGUIWidget *widget) {
-	std::vector<TGUIWidget *> found;
-	std::vector<TGUIWidget *>::iterator it;
-	for (it = stack[0]->widgets.begin(); it != stack[0]->widgets.end(); it++) {
-		if (isDeepChild(*it, widget)) {
-			found.push_back(*it);
-		}
-	}
-
-	return found;
+// Moves widget to the top (end) or bottom of the top layer, in place
+static void restack(TGUIWidget *widget, bool top)
+{
+	std::vector<TGUIWidget *> &widgets = stack[0]->widgets;
+	std::vector<TGUIWidget *>::iterator it = std::find(widgets.begin(), widgets.end(), widget);
+	if (it == widgets.end())
+		return;
+	if (top)
+		std::rotate(it, it+1, widgets.end());
+	else
+		std::rotate(widgets.begin(), it, it+1);
+	invalidatePositioners();
 }
 
+// The children of a widget are its getChild() chain (see isDeepChild),
+// moving them down the chain leaves each child above (or below) its
+// parent
 void TGUIWidget::raise() {
-	// Remove and place parent at top
-	std::vector<TGUIWidget *>::iterator it = std::find(stack[0]->widgets.begin(), stack[0]->widgets.end(), this);
-	if (it != stack[0]->widgets.end()) {
-		stack[0]->widgets.erase(it);
-		stack[0]->widgets.push_back(this);
-	}
-
-	// Do the same with all the children of this widget
-	std::vector<TGUIWidget *> toRaise = findChildren(this);
-	for (size_t i = 0; i < toRaise.size(); i++) {
-		toRaise[i]->raise();
+	for (TGUIWidget *w = this; w; w = w->getChild()) {
+		restack(w, true);
 	}
 }
 
 void TGUIWidget::lower() {
-	// Remove and place parent at top
-	std::vector<TGUIWidget *>::iterator it = std::find(stack[0]->widgets.begin(), stack[0]->widgets.end(), this);
-	if (it != stack[0]->widgets.end()) {
-		stack[0]->widgets.erase(it);
-		stack[0]->widgets.insert(stack[0]->widgets.begin(), this);
-	}
-
-	// Do the same with all the children of this widget
-	std::vector<TGUIWidget *> toLower = findChildren(this);
-	for (size_t i = 0; i < toLower.size(); i++) {
-		toLower[i]->lower();
+	for (TGUIWidget *w = this; w; w = w->getChild()) {
+		restack(w, false);
 	}
 }
 
@@ -1178,6 +2175,7 @@ void TGUIWidget::remove() {
 	std::vector<TGUIWidget *>::iterator it = std::find(stack[0]->widgets.begin(), stack[0]->widgets.end(), this);
 	if (it != stack[0]->widgets.end()) {
 		stack[0]->widgets.erase(it);
+		invalidatePositioners();
 	}
 	it = std::find(preDrawWidgets.begin(), preDrawWidgets.end(), this);
 	if (it != preDrawWidgets.end()) {
@@ -1192,7 +2190,7 @@ void TGUIWidget::remove() {
 		child->remove();
 	}
 
-	if (this == focussedWidget) {
+	if (getHandle() == focussedWidget) {
 		setFocus(NULL);
 	}
 }
@@ -1251,24 +2249,17 @@ static TGUIWidget *getWidgetInDirection(TGUIWidget *widget, int xdir, int ydir)
 		measuring_point = wy1 + widget->getHeight();
 	}
 
-	std::vector<TGUIWidget *> colliding;
+	TGUIScratchVector scratch;
+	std::vector<TGUIWidget *> &colliding = *scratch;
 
+	collideBounds(x1, y1, x2, y2);
 	for (size_t i = 0; i < stack[0]->widgets.size(); i++) {
 		TGUIWidget* w = stack[0]->widgets[i];
 		w->addCollidingChildrenToVector(colliding, widget, x1, y1, x2, y2);
-		if (w == widget || !w->acceptsFocus()) {
+		if (w == widget || !boundsHits[i] || !w->acceptsFocus()) {
 			continue;
 		}
-		int _x1, _y1, _x2, _y2;
-		int wx2, wy2;
-		determineAbsolutePosition(w, &wx2, &wy2);
-		_x1 = wx2;
-		_x2 = wx2 + w->getWidth();
-		_y1 = wy2;
-		_y2 = wy2 + w->getHeight();
-		if (checkBoxCollision(x1, y1, x2, y2, _x1, _y1, _x2, _y2)) {
-			colliding.push_back(w);
-		}
+		colliding.push_back(w);
 	}
 
 	if (colliding.size() == 0) {
@@ -1297,22 +2288,14 @@ static TGUIWidget *getWidgetInDirection(TGUIWidget *widget, int xdir, int ydir)
 			y1 = wy1 + widget->getHeight() + 1;
 			y2 = sh;
 		}
+		collideBounds(x1, y1, x2, y2);
 		for (size_t i = 0; i < stack[0]->widgets.size(); i++) {
 			TGUIWidget* w = stack[0]->widgets[i];
 			w->addCollidingChildrenToVector(colliding, widget, x1, y1, x2, y2);
-			if (w == widget || !w->acceptsFocus()) {
+			if (w == widget || !boundsHits[i] || !w->acceptsFocus()) {
 				continue;
 			}
-			int _x1, _y1, _x2, _y2;
-			int wx2, wy2;
-			determineAbsolutePosition(w, &wx2, &wy2);
-			_x1 = wx2;
-			_x2 = wx2 + w->getWidth();
-			_y1 = wy2;
-			_y2 = wy2 + w->getHeight();
-			if (checkBoxCollision(x1, y1, x2, y2, _x1, _y1, _x2, _y2)) {
-				colliding.push_back(w);
-			}
+			colliding.push_back(w);
 		}
 		if (colliding.size() == 0) {
 			return NULL;
@@ -1326,22 +2309,15 @@ static TGUIWidget *getWidgetInDirection(TGUIWidget *widget, int xdir, int ydir)
 					closest = dx;
 				}
 			}
-			// drop everything not == closest distance
-			std::vector<TGUIWidget *>::iterator it;
-			for (it = colliding.begin(); it != colliding.end();) {
-				TGUIWidget *w = *it;
-				int dx = abs((widget->getX() + widget->getWidth()/2) - (w->getX() + w->getWidth()/2));
-				if (dx != closest) {
-					it = colliding.erase(it);
-				}
-				else {
-					it++;
-				}
-			}
-			// Now return the one with the closest x (all xs are the same now or there's only 1)
+			// Of those at the closest x, return the one with the closest y
+			int closest_x = closest;
 			closest = INT_MAX;
 			TGUIWidget *closest_w = NULL;
 			for (size_t i = 0; i < colliding.size(); i++) {
+				int dx = abs((widget->getX() + widget->getWidth()/2) - (colliding[i]->getX() + colliding[i]->getWidth()/2));
+				if (dx != closest_x) {
+					continue;
+				}
 				int dy = abs((widget->getY() + widget->getHeight()/2) - (colliding[i]->getY() + colliding[i]->getHeight()/2));
 				if (dy < closest) {
 					closest = dy;
@@ -1359,22 +2335,15 @@ static TGUIWidget *getWidgetInDirection(TGUIWidget *widget, int xdir, int ydir)
 					closest = dy;
 				}
 			}
-			// drop everything not == closest distance
-			std::vector<TGUIWidget *>::iterator it;
-			for (it = colliding.begin(); it != colliding.end();) {
-				TGUIWidget *w = *it;
-				int dy = abs((widget->getY() + widget->getHeight()/2) - (w->getY() + w->getHeight()/2));
-				if (dy != closest) {
-					it = colliding.erase(it);
-				}
-				else {
-					it++;
-				}
-			}
-			// Now return the one with the closest y (all ys are the same now or there's only 1)
+			// Of those at the closest y, return the one with the closest x
+			int closest_y = closest;
 			closest = INT_MAX;
 			TGUIWidget *closest_w = NULL;
 			for (size_t i = 0; i < colliding.size(); i++) {
+				int dy = abs((widget->getY() + widget->getHeight()/2) - (colliding[i]->getY() + colliding[i]->getHeight()/2));
+				if (dy != closest_y) {
+					continue;
+				}
 				int dx = abs((widget->getX() + widget->getWidth()/2) - (colliding[i]->getX() + colliding[i]->getWidth()/2));
 				if (dx < closest) {
 					closest = dx;
@@ -1489,4 +2458,3 @@ static void drawRect(tgui::TGUI *gui, int x1, int y1, int x2, int y2)
 		}
 	}
 }
-
@@ -12,10 +12,58 @@
 #include <sys/time.h>
 #endif
 
+// Move overloads (setters taking std::string && etc) where the compiler
+// has rvalue references
+#if __cplusplus >= 201103L || (defined _MSC_VER && _MSC_VER >= 1600)
+#define TGUI_RVALUE_REFS
+#include <utility>
+#endif
+
 namespace tgui {
 
+class TGUIWidget;
+
+// A generational reference to a widget. The index selects a slot in the
+// widget table and the generation is bumped whenever that slot is freed, so
+// a handle to a deleted widget (after pop(), shutdown() etc) is detected in
+// O(1) instead of dangling. The index is dense and can be used to key side
+// tables (see getWidgetTableSize()). Widgets only store the index, the
+// generation lives in the table.
+struct TGUIHandle {
+	unsigned int index;
+	unsigned int generation;
+
+	bool isNull() const { return generation == 0; }
+
+	bool operator==(const TGUIHandle &h) const {
+		return index == h.index && generation == h.generation;
+	}
+	bool operator!=(const TGUIHandle &h) const {
+		return !(*this == h);
+	}
+
+	TGUIHandle() :
+		index(0),
+		generation(0)
+	{
+	}
+
+	TGUIHandle(unsigned int index, unsigned int generation) :
+		index(index),
+		generation(generation)
+	{
+	}
+};
+
 // forward declarations
 void getScreenSize(int *w, int *h);
+TGUIHandle registerWidget(TGUIWidget *widget);
+// Frees widget's slot (index), if widget is still what it holds
+void unregisterWidget(TGUIWidget *widget, unsigned int index);
+// Hit-testing and focus search use a cached copy of the widget bounds.
+// Widgets that write x/y/width/height directly instead of going through
+// the setters must call this afterwards.
+void invalidateBounds();
 
 class TGUIWidget {
 public:
@@ -25,13 +73,15 @@ public:
 
 	float getX() { return x; }
 	float getY() { return y; }
-	virtual void setX(float newX) { x = newX; }
-	virtual void setY(float newY) { y = newY; }
+	virtual void setX(float newX) { x = newX; invalidateBounds(); }
+	virtual void setY(float newY) { y = newY; invalidateBounds(); }
 
 	int getWidth() { return width; }
 	int getHeight() { return height; }
-	virtual void setWidth(int w) { width = w; }
-	virtual void setHeight(int h) { height = h; }
+	virtual void setWidth(int w) { width = w; invalidateBounds(); }
+	virtual void setHeight(int h) { height = h; invalidateBounds(); }
+
+	TGUIHandle getHandle();
 
 	TGUIWidget *getParent() { return parent; }
 	void setParent(TGUIWidget *p) { parent = p; }
@@ -39,6 +89,11 @@ public:
 	TGUIWidget *getChild() { return child; }
 	void setChild(TGUIWidget *c) { child = c; }
 	virtual bool getAbsoluteChildPosition(TGUIWidget *child, int *x, int *y) { return false; }
+	// Only widgets with this set are asked getAbsoluteChildPosition. It
+	// defaults to true; leaf widgets should turn it off so position lookups
+	// don't visit them (matters with many widgets in a layer).
+	bool getPositionsChildren() { return positionsChildren; }
+	void setPositionsChildren(bool positions);
 
 	virtual void draw(int abs_x, int abs_y) {}
 	// -- only called if registered
@@ -55,9 +110,32 @@ public:
 		return NULL;
 	}
 	virtual void resize() {
+		float w = width;
+		float h = height;
 		resize_self();
+		if (width != w || height != h) {
+			invalidateLayout();
+		}
 		resize_child();
 	}
+	// Containers position/size their children here. Call
+	// invalidateLayout() when something it depends on changes: dirty
+	// widgets are laid out once, outermost first, before the next
+	// update/draw/event (see tgui::updateLayout()).
+	virtual void layout() {}
+	void invalidateLayout();
+	// Called just before layout(), always on the thread that called
+	// tgui::updateLayout(). With tgui::setLayoutThreads() layout() may run
+	// on a worker thread, so it must only touch this widget and its
+	// children; anything else (measuring text etc) belongs here.
+	virtual void prepareLayout() {}
+	// Natural size, for containers that size children to their content
+	// (TGUI_Flex). Call invalidateMeasure() when it changes (new text
+	// etc) and the parent measures this widget again on its next layout.
+	virtual void measure(int *w, int *h) { *w = width; *h = height; }
+	void invalidateMeasure();
+	// true once after each invalidateMeasure()
+	bool takeMeasurePending();
 	virtual void translate(int xx, int yy) {
 		if (child) {
 			child->translate(xx, yy);
@@ -116,6 +194,11 @@ public:
 	
 	virtual bool acceptsFocus() { return false; }
 
+	// Bitmask saying what this widget is, so hot paths can test a bit
+	// instead of dynamic_cast. Subclasses return their base's bits plus
+	// their own (see TGUI_Kind in tgui2_widgets.hpp).
+	virtual unsigned int getKind() { return 0; }
+
 
 	virtual TGUIWidget *chainMouseMove(int rel_x, int rel_y, int abs_x, int abs_y, int z, int w);
 	virtual TGUIWidget *chainMouseDown(int rel_x, int rel_y, int abs_x, int abs_y, int mb);
@@ -135,22 +218,51 @@ public:
 
 	virtual void addCollidingChildrenToVector(std::vector<tgui::TGUIWidget *> &v, tgui::TGUIWidget *exception, int x1, int y1, int x2, int y2) {}
 
-	void setFocusGroup(int focusGroup, int numberInFocusGroup) {
-		this->focusGroup = focusGroup;
-		this->numberInFocusGroup = numberInFocusGroup;
-	}
+	// stored in a side table, see tgui2.cpp
+	void setFocusGroup(int focusGroup, int numberInFocusGroup);
+	int getFocusGroup();
+	int getNumberInFocusGroup();
 	bool getDrawFocus() { return drawFocus; }
 	void setDrawFocus(bool draw) { drawFocus = draw; }
 
 	TGUIWidget() :
 		parent(NULL),
 		child(NULL),
-		focusGroup(0),
-		drawFocus(true)
+		drawFocus(true),
+		positionsChildren(true)
+	{
+		handleIndex = registerWidget(this).index;
+	}
+
+	// A copy gets a slot (and handle) of its own
+	TGUIWidget(const TGUIWidget &w) :
+		x(w.x),
+		y(w.y),
+		width(w.width),
+		height(w.height),
+		parent(w.parent),
+		child(w.child),
+		drawFocus(w.drawFocus),
+		positionsChildren(w.positionsChildren)
 	{
+		handleIndex = registerWidget(this).index;
+	}
+
+	TGUIWidget &operator=(const TGUIWidget &w) {
+		x = w.x;
+		y = w.y;
+		width = w.width;
+		height = w.height;
+		parent = w.parent;
+		child = w.child;
+		drawFocus = w.drawFocus;
+		positionsChildren = w.positionsChildren;
+		return *this;
 	}
 
-	virtual ~TGUIWidget() {}
+	virtual ~TGUIWidget() {
+		unregisterWidget(this, handleIndex);
+	}
 
 protected:
 
@@ -172,16 +284,20 @@ protected:
 			child->resize();
 	}
 
+	// Everything traversal touches is kept together at the front; rarely
+	// used per-widget state (focus groups) lives in a side table keyed by
+	// handleIndex. Subclasses can pack small members into the tail padding
+	// after the flags.
 	float x;
 	float y;
 	float width;
 	float height;
 	TGUIWidget *parent;
 	TGUIWidget *child;
+	unsigned int handleIndex;
 
-	int focusGroup;
-	int numberInFocusGroup;
 	bool drawFocus;
+	bool positionsChildren;
 };
 
 long currentTimeMillis();
@@ -191,11 +307,18 @@ void setFocus(TGUIWidget *widget);
 TGUIWidget *getFocussedWidget();
 void focusPrevious();
 void focusNext();
+// Moves every widget on the top layer, see translateView() for panning
 void translateAll(int x, int y);
 void addWidget(TGUIWidget *widget);
 TGUIWidget *update();
 std::vector<TGUIWidget *> updateAll();
+// Same, into widgets (cleared first) so it can be reused every frame
+void updateAll(std::vector<TGUIWidget *> &widgets);
 void draw();
+void updateLayout();
+// Lay out independent subtrees on count threads (including the caller),
+// 0 or 1 for serial. Results are the same either way.
+void setLayoutThreads(int count);
 void drawRect(int x1, int y1, int x2, int y2);
 void push();
 bool pop();
@@ -203,6 +326,12 @@ void setNewWidgetParent(TGUIWidget *parent);
 TGUIWidget *getNewWidgetParent();
 void centerWidget(TGUIWidget *widget, int x, int y);
 bool widgetIsChildOf(TGUIWidget *widget, TGUIWidget *parent);
+// View transform of the top layer: its widgets are drawn at
+// position*scale + (x, y) and pointer events are mapped back. Panning
+// and zooming this way is O(1) and keeps cached positions valid.
+void setView(float x, float y, float scale = 1.0f);
+void getView(float *x, float *y, float *scale);
+void translateView(float x, float y);
 void setScale(float x_scale, float y_scale);
 void setOffset(float x_offset, float y_offset);
 void ignore(int type);
@@ -216,12 +345,17 @@ void setFont(ALLEGRO_FONT *font);
 void determineAbsolutePosition(TGUIWidget *widget, int *x, int *y);
 TGUIWidget *determineTopLevelOwner(int x, int y);
 bool pointOnWidget(TGUIWidget *widget, int x, int y);
+// handleEvent takes care of ALLEGRO_EVENT_DISPLAY_RESIZE (one relayout per
+// frame), call this only when sizes change some other way
 void resize(TGUIWidget *parent);
 void clearClip();
 void setClippedClip(int x, int y, int width, int height);
 void setClip(int x, int y, int width, int height);
 bool isClipSet();
 void getClip(int *x, int *y, int *w, int *h);
+// The clipping rectangle in drawing coordinates, through the inverse of
+// the current transform. false (and nothing set) if the transform rotates.
+bool getLocalClip(float *x1, float *y1, float *x2, float *y2);
 void raiseWidget(TGUIWidget *widget);
 void lowerWidget(TGUIWidget *widget);
 bool isDeepChild(TGUIWidget *parent, TGUIWidget *widget);
@@ -234,9 +368,75 @@ void setScreenSize(int w, int h);
 ALLEGRO_DISPLAY *getDisplay();
 void drawFocusRectangle(int x, int y, int w, int h);
 bool checkBoxCollision(int x1, int y1, int x2, int y2, int x3, int y3, int x4, int y4);
+// Batch versions of pointOnWidget/checkBoxCollision over structure-of-arrays
+// bounds (SSE2/AVX2 when available). findBoxContainingPoint returns the
+// highest index containing the point or -1, checkBoxCollisions fills
+// result[i] with 0/1 and returns the number of hits.
+int findBoxContainingPoint(const int *x1, const int *y1, const int *x2, const int *y2, int count, int x, int y);
+int checkBoxCollisions(const int *x1, const int *y1, const int *x2, const int *y2, int count, int rx1, int ry1, int rx2, int ry2, unsigned char *result);
 void hide();
 void unhide();
 void releaseKeysAndButtons();
+TGUIWidget *getWidget(TGUIHandle handle);
+bool isValid(TGUIHandle handle);
+unsigned int getWidgetTableSize();
+unsigned int getPerWidgetOverhead();
+
+// A vector of widgets borrowed from a pool for the length of a scope, for
+// temporaries in traversal and event code (widgets' too). It starts
+// empty but keeps its capacity from earlier use, so once the pool is warm
+// nothing is allocated. Scopes can nest. Gui thread only.
+class TGUIScratchVector {
+public:
+	std::vector<TGUIWidget *> &operator*() { return *v; }
+	std::vector<TGUIWidget *> *operator->() { return v; }
+
+	TGUIScratchVector();
+	~TGUIScratchVector();
+
+private:
+	TGUIScratchVector(const TGUIScratchVector &);
+	TGUIScratchVector &operator=(const TGUIScratchVector &);
+
+	std::vector<TGUIWidget *> *v;
+	size_t capacity; // when borrowed, to count growth
+};
+
+// Heap allocations made by the gui. Only allocations on the thread
+// inside handleEvent(), update(), updateAll() or draw() are counted,
+// into the phase that call belongs to. Whatever allocates calls
+// countAllocation(), outside those calls it costs a test. tgui doesn't
+// touch operator new; instead the buffers it keeps between calls
+// (TGUIScratchVector, layout and hit-test arrays, text metrics) count
+// themselves when they grow, see countGrowth(). Allegro's allocations
+// are counted with setAllegroAllocationCounting(), and an app that
+// wants its own counted calls countAllocation() from its allocator.
+enum TGUIAllocationPhase {
+	TGUI_ALLOC_EVENT = 0,
+	TGUI_ALLOC_UPDATE,
+	TGUI_ALLOC_DRAW,
+	TGUI_ALLOC_PHASES
+};
+void countAllocation(size_t bytes);
+// For a container kept between calls: counts an allocation if v was
+// reallocated past old_capacity
+template <class V> inline void countGrowth(const V &v, size_t old_capacity)
+{
+	if (v.capacity() > old_capacity)
+		countAllocation(v.capacity() * sizeof(typename V::value_type));
+}
+void getAllocationStats(int phase, unsigned long *count, unsigned long *bytes);
+void resetAllocationStats();
+// Counts Allegro's allocations (bitmaps, ustrs, font caches...) by
+// installing an Allegro memory interface. Allegro can't say which one
+// is installed, so pass the app's own (NULL for malloc/free): counted
+// calls go on to it, and it's put back when counting stops. A memory
+// interface set later replaces this one.
+void setAllegroAllocationCounting(bool count, ALLEGRO_MEMORY_INTERFACE *app = NULL);
+// Zero allocation test mode, for steady frames (nothing changing, caches
+// warm): while on, a counted allocation calls handler with its size and
+// phase, or prints them to stderr and aborts when handler is NULL
+void setAllocationCheck(bool check, void (*handler)(size_t bytes, int phase) = NULL);
 
 } // End namespace tgui
 
@@ -0,0 +1,1443 @@
+#define ALLEGRO_STATICLINK
+
+#include "tgui2_text.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+namespace tgui {
+
+	static const int FIRST_ASCII = 32;
+	static const int NUM_ASCII = 95; // ' ' to '~'
+
+	// Cached widths per font, the least recently used go past this (a
+	// text field being typed into makes a new string every key)
+	static const size_t MAX_CACHED_WIDTHS = 1024;
+	// Rendered strings kept per font
+	static const size_t MAX_TEXT_RUNS = 256;
+
+	struct TGUITextWidth {
+		int width;
+		unsigned int last_used;
+	};
+
+	// A string rendered in white for drawText
+	struct TGUITextRun {
+		ALLEGRO_BITMAP *bitmap; // NULL if nothing is visible
+		int x; // bitmap offset from the text position
+		int y;
+		int width; // text width, for alignment
+		unsigned int last_used;
+	};
+
+	struct TGUIFontMetrics {
+		const ALLEGRO_FONT *font;
+		int line_height;
+		int advances[NUM_ASCII];
+		int mono_advance; // -1 if not monospace
+		std::map<std::string, TGUITextWidth> widths;
+		std::map<std::string, TGUITextRun> runs;
+	};
+
+	// Layouts kept for drawWrappedText
+	static const size_t MAX_WRAPPED_TEXTS = 128;
+
+	// Keyed by text so looking one up copies nothing
+	struct TGUIWrappedText {
+		const ALLEGRO_FONT *font;
+		int width;
+		int flags;
+		TGUITextLayout layout;
+		unsigned int last_used;
+	};
+
+}
+
+using namespace tgui;
+
+static std::vector<TGUIFontMetrics *> fonts;
+static bool textCaching = false;
+static unsigned int runClock = 0;
+
+static std::multimap<std::string, TGUIWrappedText> wrappedTexts;
+
+// loadBakedFontInBackground's arguments and results. The worker only
+// touches these (and its own font and bitmaps) until prewarmDone is set.
+struct TGUIBakeJob {
+	std::string filename;
+	int size;
+	int flags;
+	std::string charset;
+	std::string cache_dir; // empty for none
+	ALLEGRO_BITMAP *atlas;
+	std::vector<int> ranges;
+};
+
+static ALLEGRO_THREAD *prewarmThread = NULL;
+static ALLEGRO_MUTEX *prewarmMutex = NULL;
+static bool prewarmDone;
+static TGUIBakeJob bakeJob;
+// made on the main thread from bakeJob, until takeBakedFont()
+static ALLEGRO_FONT *bakedFont = NULL;
+
+static TGUIFontMetrics *getMetrics(const ALLEGRO_FONT *font)
+{
+	for (size_t i = 0; i < fonts.size(); i++) {
+		if (fonts[i]->font == font) {
+			if (i > 0) {
+				// keep the most used at the front
+				std::swap(fonts[i], fonts[i-1]);
+				return fonts[i-1];
+			}
+			return fonts[i];
+		}
+	}
+
+	TGUIFontMetrics *m = new TGUIFontMetrics;
+	m->font = font;
+	m->line_height = al_get_font_line_height(font);
+
+	char s[2] = { 0, 0 };
+	for (int i = 0; i < NUM_ASCII; i++) {
+		s[0] = FIRST_ASCII + i;
+		m->advances[i] = al_get_text_width(font, s);
+	}
+
+	m->mono_advance = m->advances[0];
+	for (int i = 1; i < NUM_ASCII; i++) {
+		if (m->advances[i] != m->mono_advance) {
+			m->mono_advance = -1;
+			break;
+		}
+	}
+
+	fonts.push_back(m);
+
+	return m;
+}
+
+static void destroyMetrics(TGUIFontMetrics *m)
+{
+	std::map<std::string, TGUITextRun>::iterator it;
+	for (it = m->runs.begin(); it != m->runs.end(); it++) {
+		if (it->second.bitmap) {
+			al_destroy_bitmap(it->second.bitmap);
+		}
+	}
+	delete m;
+}
+
+// Width of text if it's all printable ASCII and the font is monospace,
+// otherwise -1
+static int getMonospaceWidth(TGUIFontMetrics *m, const char *text, size_t length)
+{
+	if (m->mono_advance < 0)
+		return -1;
+
+	for (size_t i = 0; i < length; i++) {
+		unsigned char c = text[i];
+		if (c < FIRST_ASCII || c >= FIRST_ASCII+NUM_ASCII)
+			return -1;
+	}
+
+	return m->mono_advance * length;
+}
+
+// Only translation, so a cached bitmap lands on the same pixels the glyphs
+// would
+static bool isPlainTransform()
+{
+	const ALLEGRO_TRANSFORM *t = al_get_current_transform();
+	return t->m[0][0] == 1 && t->m[1][1] == 1 && t->m[0][1] == 0 && t->m[1][0] == 0;
+}
+
+static void dropOldestWidth(TGUIFontMetrics *m)
+{
+	std::map<std::string, TGUITextWidth>::iterator oldest = m->widths.begin();
+	std::map<std::string, TGUITextWidth>::iterator it;
+	for (it = m->widths.begin(); it != m->widths.end(); it++) {
+		if (it->second.last_used < oldest->second.last_used) {
+			oldest = it;
+		}
+	}
+	m->widths.erase(oldest);
+}
+
+static void dropOldestRun(TGUIFontMetrics *m)
+{
+	std::map<std::string, TGUITextRun>::iterator oldest = m->runs.begin();
+	std::map<std::string, TGUITextRun>::iterator it;
+	for (it = m->runs.begin(); it != m->runs.end(); it++) {
+		if (it->second.last_used < oldest->second.last_used) {
+			oldest = it;
+		}
+	}
+	if (oldest->second.bitmap) {
+		al_destroy_bitmap(oldest->second.bitmap);
+	}
+	m->runs.erase(oldest);
+}
+
+// NULL if a bitmap couldn't be made
+static TGUITextRun *getRun(TGUIFontMetrics *m, const std::string &text)
+{
+	std::map<std::string, TGUITextRun>::iterator it = m->runs.find(text);
+	if (it != m->runs.end()) {
+		it->second.last_used = runClock++;
+		return &it->second;
+	}
+
+	TGUITextRun run;
+	int w, h;
+	al_get_text_dimensions(m->font, text.c_str(), &run.x, &run.y, &w, &h);
+	run.width = getTextWidth(m->font, text);
+	run.bitmap = NULL;
+	run.last_used = runClock++;
+
+	if (w > 0 && h > 0) {
+		ALLEGRO_STATE state;
+		al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP | ALLEGRO_STATE_TRANSFORM | ALLEGRO_STATE_BLENDER);
+		run.bitmap = al_create_bitmap(w, h);
+		if (run.bitmap) {
+			ALLEGRO_TRANSFORM t;
+			al_set_target_bitmap(run.bitmap);
+			al_identity_transform(&t);
+			al_use_transform(&t);
+			al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_INVERSE_ALPHA);
+			al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+			al_draw_text(m->font, al_map_rgb(0xff, 0xff, 0xff), -run.x, -run.y, 0, text.c_str());
+		}
+		al_restore_state(&state);
+		if (!run.bitmap)
+			return NULL;
+	}
+
+	if (m->runs.size() >= MAX_TEXT_RUNS) {
+		dropOldestRun(m);
+	}
+
+	return &(m->runs[text] = run);
+}
+
+// Sorted, without duplicates
+static void getCodePoints(const char *charset, std::vector<int> &code_points)
+{
+	size_t pos = 0;
+	int cp;
+	while ((cp = utf8Next(charset, &pos)) >= 0) {
+		code_points.push_back(cp);
+	}
+	std::sort(code_points.begin(), code_points.end());
+	code_points.erase(std::unique(code_points.begin(), code_points.end()), code_points.end());
+}
+
+static void rasterise(ALLEGRO_FONT *font, const char *charset)
+{
+	ALLEGRO_STATE state;
+	al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP);
+
+	// Drawing each glyph once makes the font cache it. On a thread with
+	// no display the target is a memory bitmap.
+	ALLEGRO_BITMAP *target = al_create_bitmap(1, 1);
+	if (target) {
+		al_set_target_bitmap(target);
+		size_t pos = 0;
+		int cp;
+		while ((cp = utf8Next(charset, &pos)) >= 0) {
+			al_draw_glyph(font, al_map_rgb(0xff, 0xff, 0xff), 0, 0, cp);
+		}
+	}
+
+	al_restore_state(&state);
+
+	if (target) {
+		al_destroy_bitmap(target);
+	}
+}
+
+static std::string getBakedFontPath(const char *filename, int size, int flags, const char *charset, const char *cache_dir)
+{
+	// FNV-1a
+	unsigned int hash = 2166136261u;
+	char params[64];
+	sprintf(params, "\n%d\n%d\n", size, flags);
+	const char *parts[3] = { filename, params, charset };
+	for (int i = 0; i < 3; i++) {
+		for (const char *p = parts[i]; *p; p++) {
+			hash = (hash ^ (unsigned char)*p) * 16777619u;
+		}
+	}
+
+	char name[32];
+	sprintf(name, "/tgui-font-%08x.png", hash);
+
+	return std::string(cache_dir) + name;
+}
+
+// Renders code_points in al_grab_font_from_bitmap's layout: cells of
+// advance x line height, one pixel of background colour around each
+static ALLEGRO_BITMAP *bakeAtlas(ALLEGRO_FONT *font, const std::vector<int> &code_points)
+{
+	static const int MAX_ATLAS_WIDTH = 1024;
+
+	int lh = al_get_font_line_height(font);
+	std::vector<int> advances;
+	int w = 1;
+	int h = 1 + lh + 1;
+	int x = 1;
+	for (size_t i = 0; i < code_points.size(); i++) {
+		int advance = al_get_text_width(font, utf8Encode(code_points[i]).c_str());
+		if (advance < 1)
+			advance = 1;
+		advances.push_back(advance);
+		if (x + advance + 1 > MAX_ATLAS_WIDTH && x > 1) {
+			x = 1;
+			h += lh + 1;
+		}
+		x += advance + 1;
+		if (x > w)
+			w = x;
+	}
+
+	ALLEGRO_STATE state;
+	al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP | ALLEGRO_STATE_TRANSFORM | ALLEGRO_STATE_BLENDER);
+
+	ALLEGRO_BITMAP *atlas = al_create_bitmap(w, h);
+	if (atlas) {
+		ALLEGRO_TRANSFORM t;
+		al_set_target_bitmap(atlas);
+		al_identity_transform(&t);
+		al_use_transform(&t);
+		al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_INVERSE_ALPHA);
+		al_clear_to_color(al_map_rgb(0xff, 0xff, 0x00));
+		x = 1;
+		int y = 1;
+		for (size_t i = 0; i < code_points.size(); i++) {
+			if (x + advances[i] + 1 > MAX_ATLAS_WIDTH && x > 1) {
+				x = 1;
+				y += lh + 1;
+			}
+			al_set_clipping_rectangle(x, y, advances[i], lh);
+			al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+			al_draw_glyph(font, al_map_rgb(0xff, 0xff, 0xff), x, y, code_points[i]);
+			x += advances[i] + 1;
+		}
+		al_set_clipping_rectangle(0, 0, w, h);
+	}
+
+	al_restore_state(&state);
+
+	return atlas;
+}
+
+// The atlas loadBakedFont grabs its font from, and that font's ranges
+static ALLEGRO_BITMAP *loadAtlas(const char *filename, int size, int flags, const char *charset, const char *cache_dir, std::vector<int> &ranges)
+{
+	std::vector<int> code_points;
+	getCodePoints(charset, code_points);
+	if (code_points.size() == 0)
+		return NULL;
+
+	for (size_t i = 0; i < code_points.size(); i++) {
+		if (i == 0 || code_points[i] != code_points[i-1]+1) {
+			ranges.push_back(code_points[i]);
+			ranges.push_back(code_points[i]);
+		}
+		else {
+			ranges.back() = code_points[i];
+		}
+	}
+
+	std::string path;
+	ALLEGRO_BITMAP *atlas = NULL;
+	if (cache_dir) {
+		path = getBakedFontPath(filename, size, flags, charset, cache_dir);
+		if (al_filename_exists(path.c_str())) {
+			atlas = al_load_bitmap(path.c_str());
+		}
+	}
+
+	if (!atlas) {
+		ALLEGRO_FONT *ttf = al_load_ttf_font(filename, size, flags);
+		if (!ttf)
+			return NULL;
+		atlas = bakeAtlas(ttf, code_points);
+		al_destroy_font(ttf);
+		if (!atlas)
+			return NULL;
+		if (cache_dir) {
+			al_make_directory(cache_dir);
+			al_save_bitmap(path.c_str(), atlas);
+		}
+	}
+
+	return atlas;
+}
+
+static void *prewarmProc(ALLEGRO_THREAD *thread, void *arg)
+{
+	(void)thread;
+	(void)arg;
+
+	// This thread's own TTF font, glyph pages and atlas are all memory
+	// bitmaps, and nothing else sees them
+	al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+	bakeJob.atlas = loadAtlas(bakeJob.filename.c_str(), bakeJob.size, bakeJob.flags, bakeJob.charset.c_str(),
+		bakeJob.cache_dir.empty() ? NULL : bakeJob.cache_dir.c_str(), bakeJob.ranges);
+
+	al_lock_mutex(prewarmMutex);
+	prewarmDone = true;
+	al_unlock_mutex(prewarmMutex);
+
+	return NULL;
+}
+
+// On the main thread: waits for the worker and makes the font. The font
+// copies the atlas into bitmaps made here, so no memory bitmap needs
+// converting.
+static void finishPrewarm()
+{
+	al_join_thread(prewarmThread, NULL);
+	al_destroy_thread(prewarmThread);
+	al_destroy_mutex(prewarmMutex);
+	prewarmThread = NULL;
+	prewarmMutex = NULL;
+
+	if (bakeJob.atlas) {
+		bakedFont = al_grab_font_from_bitmap(bakeJob.atlas, bakeJob.ranges.size()/2, &bakeJob.ranges[0]);
+		al_destroy_bitmap(bakeJob.atlas);
+		bakeJob.atlas = NULL;
+	}
+	bakeJob.ranges.clear();
+}
+
+namespace tgui {
+
+int utf8Next(const char *s, size_t *pos)
+{
+	return utf8Next(s, pos, (size_t)-1);
+}
+
+int utf8Next(const char *s, size_t *pos, size_t end)
+{
+	while (*pos < end && s[*pos]) {
+		unsigned char c = s[*pos];
+		int extra;
+		int cp;
+		if (c < 0x80) {
+			(*pos)++;
+			return c;
+		}
+		else if ((c & 0xE0) == 0xC0) {
+			extra = 1;
+			cp = c & 0x1F;
+		}
+		else if ((c & 0xF0) == 0xE0) {
+			extra = 2;
+			cp = c & 0x0F;
+		}
+		else if ((c & 0xF8) == 0xF0) {
+			extra = 3;
+			cp = c & 0x07;
+		}
+		else {
+			(*pos)++;
+			continue;
+		}
+		size_t i = 1;
+		for (; i <= (size_t)extra && *pos+i < end; i++) {
+			unsigned char cc = s[*pos+i];
+			if ((cc & 0xC0) != 0x80)
+				break;
+			cp = (cp << 6) | (cc & 0x3F);
+		}
+		*pos += i;
+		if (i > (size_t)extra)
+			return cp;
+	}
+
+	return -1;
+}
+
+std::string utf8Encode(int code_point)
+{
+	std::string s;
+	int cp = code_point;
+
+	if (cp < 0x80) {
+		s += (char)cp;
+	}
+	else if (cp < 0x800) {
+		s += (char)(0xC0 | (cp >> 6));
+		s += (char)(0x80 | (cp & 0x3F));
+	}
+	else if (cp < 0x10000) {
+		s += (char)(0xE0 | (cp >> 12));
+		s += (char)(0x80 | ((cp >> 6) & 0x3F));
+		s += (char)(0x80 | (cp & 0x3F));
+	}
+	else {
+		s += (char)(0xF0 | (cp >> 18));
+		s += (char)(0x80 | ((cp >> 12) & 0x3F));
+		s += (char)(0x80 | ((cp >> 6) & 0x3F));
+		s += (char)(0x80 | (cp & 0x3F));
+	}
+
+	return s;
+}
+
+int getTextWidth(const ALLEGRO_FONT *font, const std::string &text)
+{
+	TGUIFontMetrics *m = getMetrics(font);
+
+	int w = getMonospaceWidth(m, text.c_str(), text.length());
+	if (w >= 0)
+		return w;
+
+	std::map<std::string, TGUITextWidth>::iterator it = m->widths.find(text);
+	if (it != m->widths.end()) {
+		it->second.last_used = runClock++;
+		return it->second.width;
+	}
+
+	if (m->widths.size() >= MAX_CACHED_WIDTHS) {
+		dropOldestWidth(m);
+	}
+
+	TGUITextWidth &tw = m->widths[text];
+	tw.width = al_get_text_width(font, text.c_str());
+	tw.last_used = runClock++;
+
+	return tw.width;
+}
+
+int getTextWidth(const ALLEGRO_FONT *font, const char *text)
+{
+	int w = getMonospaceWidth(getMetrics(font), text, strlen(text));
+	if (w >= 0)
+		return w;
+
+	return getTextWidth(font, std::string(text));
+}
+
+int getLineHeight(const ALLEGRO_FONT *font)
+{
+	return getMetrics(font)->line_height;
+}
+
+int getGlyphAdvance(const ALLEGRO_FONT *font, int c)
+{
+	if (c < FIRST_ASCII || c >= FIRST_ASCII+NUM_ASCII)
+		return -1;
+
+	return getMetrics(font)->advances[c-FIRST_ASCII];
+}
+
+int getCodePointAdvance(const ALLEGRO_FONT *font, int code_point)
+{
+	TGUIFontMetrics *m = getMetrics(font);
+
+	if (code_point >= FIRST_ASCII && code_point < FIRST_ASCII+NUM_ASCII)
+		return m->advances[code_point-FIRST_ASCII];
+
+	return getTextWidth(font, utf8Encode(code_point));
+}
+
+bool isMonospace(const ALLEGRO_FONT *font)
+{
+	return getMetrics(font)->mono_advance >= 0;
+}
+
+void drawText(const ALLEGRO_FONT *font, ALLEGRO_COLOR color, float x, float y, int flags, const std::string &text)
+{
+	TGUITextRun *run = NULL;
+
+	if (textCaching && (flags & ~(ALLEGRO_ALIGN_CENTRE | ALLEGRO_ALIGN_RIGHT)) == 0 && isPlainTransform()) {
+		run = getRun(getMetrics(font), text);
+	}
+
+	if (!run) {
+		al_draw_text(font, color, x, y, flags, text.c_str());
+		return;
+	}
+
+	if (!run->bitmap)
+		return;
+
+	if (flags & ALLEGRO_ALIGN_RIGHT) {
+		x -= run->width;
+	}
+	else if (flags & ALLEGRO_ALIGN_CENTRE) {
+		x -= run->width / 2.0f;
+	}
+
+	al_draw_tinted_bitmap(run->bitmap, color, x + run->x, y + run->y, 0);
+}
+
+float drawClippedText(const ALLEGRO_FONT *font, ALLEGRO_COLOR color, float x, float y, const char *text, int length)
+{
+	if (length < 0)
+		length = strlen(text);
+
+	float left, top, right, bottom;
+	bool cull = getLocalClip(&left, &top, &right, &bottom);
+	if (cull && (y >= bottom || y + getLineHeight(font) <= top))
+		return x;
+
+	TGUIFontMetrics *m = getMetrics(font);
+
+	int pos = 0;
+	while (pos < length) {
+		unsigned char c = text[pos];
+		int cp;
+		int adv;
+		if (c >= FIRST_ASCII && c < FIRST_ASCII+NUM_ASCII) {
+			cp = c;
+			adv = m->advances[c-FIRST_ASCII];
+			pos++;
+		}
+		else {
+			size_t p = pos;
+			cp = utf8Next(text, &p, length);
+			if (cp < 0)
+				break;
+			adv = getCodePointAdvance(font, cp);
+			pos = p;
+		}
+
+		if (cull && x >= right)
+			break;
+		if (!cull || x + adv > left)
+			al_draw_glyph(font, color, x, y, cp);
+		x += adv;
+	}
+
+	return x;
+}
+
+int getTextAdvance(const ALLEGRO_FONT *font, const char *text, int length)
+{
+	if (length < 0)
+		length = strlen(text);
+
+	TGUIFontMetrics *m = getMetrics(font);
+
+	int w = 0;
+	size_t pos = 0;
+	while ((int)pos < length) {
+		unsigned char c = text[pos];
+		if (c >= FIRST_ASCII && c < FIRST_ASCII+NUM_ASCII) {
+			w += m->advances[c-FIRST_ASCII];
+			pos++;
+			continue;
+		}
+		int cp = utf8Next(text, &pos, length);
+		if (cp < 0)
+			break;
+		w += getCodePointAdvance(font, cp);
+	}
+
+	return w;
+}
+
+void setTextCaching(bool cache)
+{
+	textCaching = cache;
+}
+
+bool getTextCaching()
+{
+	return textCaching;
+}
+
+void prewarmFont(ALLEGRO_FONT *font, const char *charset)
+{
+	rasterise(font, charset);
+}
+
+void loadBakedFontInBackground(const char *filename, int size, int flags, const char *charset, const char *cache_dir)
+{
+	if (prewarmThread) {
+		// one at a time
+		finishPrewarm();
+	}
+	if (bakedFont) {
+		al_destroy_font(bakedFont);
+		bakedFont = NULL;
+	}
+
+	bakeJob.filename = filename;
+	bakeJob.size = size;
+	bakeJob.flags = flags;
+	bakeJob.charset = charset;
+	bakeJob.cache_dir = cache_dir ? cache_dir : "";
+	bakeJob.atlas = NULL;
+	bakeJob.ranges.clear();
+
+	prewarmDone = false;
+	prewarmMutex = al_create_mutex();
+	prewarmThread = al_create_thread(prewarmProc, NULL);
+	if (!prewarmThread) {
+		al_destroy_mutex(prewarmMutex);
+		prewarmMutex = NULL;
+		bakedFont = loadBakedFont(filename, size, flags, charset, cache_dir);
+		return;
+	}
+	al_start_thread(prewarmThread);
+}
+
+bool isPrewarming()
+{
+	if (!prewarmThread)
+		return false;
+
+	al_lock_mutex(prewarmMutex);
+	bool done = prewarmDone;
+	al_unlock_mutex(prewarmMutex);
+
+	if (!done)
+		return true;
+
+	finishPrewarm();
+
+	return false;
+}
+
+ALLEGRO_FONT *takeBakedFont()
+{
+	if (isPrewarming())
+		return NULL;
+
+	ALLEGRO_FONT *font = bakedFont;
+	bakedFont = NULL;
+	return font;
+}
+
+ALLEGRO_FONT *loadBakedFont(const char *filename, int size, int flags, const char *charset, const char *cache_dir)
+{
+	std::vector<int> ranges;
+	ALLEGRO_BITMAP *atlas = loadAtlas(filename, size, flags, charset, cache_dir, ranges);
+	if (!atlas)
+		return NULL;
+
+	ALLEGRO_FONT *font = al_grab_font_from_bitmap(atlas, ranges.size()/2, &ranges[0]);
+	al_destroy_bitmap(atlas);
+
+	return font;
+}
+
+void forgetFont(const ALLEGRO_FONT *font)
+{
+	std::multimap<std::string, TGUIWrappedText>::iterator it = wrappedTexts.begin();
+	while (it != wrappedTexts.end()) {
+		if (it->second.font == font)
+			wrappedTexts.erase(it++);
+		else
+			it++;
+	}
+
+	for (size_t i = 0; i < fonts.size(); i++) {
+		if (fonts[i]->font == font) {
+			destroyMetrics(fonts[i]);
+			fonts.erase(fonts.begin()+i);
+			return;
+		}
+	}
+}
+
+void forgetAllFonts()
+{
+	// the worker may still be using the app's font file and cache dir
+	if (prewarmThread) {
+		finishPrewarm();
+	}
+
+	for (size_t i = 0; i < fonts.size(); i++) {
+		destroyMetrics(fonts[i]);
+	}
+	fonts.clear();
+	wrappedTexts.clear();
+}
+
+void TGUITextLayout::clear()
+{
+	spans.clear();
+	dirty = true;
+}
+
+void TGUITextLayout::addText(const std::string &text, ALLEGRO_COLOR color, const ALLEGRO_FONT *font)
+{
+	Span s;
+	s.text = text;
+	s.color = color;
+	s.font = font;
+	s.icon = NULL;
+	spans.push_back(s);
+	dirty = true;
+}
+
+void TGUITextLayout::addIcon(ALLEGRO_BITMAP *icon)
+{
+	Span s;
+	s.color = al_map_rgb(0xff, 0xff, 0xff);
+	s.font = NULL;
+	s.icon = icon;
+	spans.push_back(s);
+	dirty = true;
+}
+
+void TGUITextLayout::setText(const std::string &text, ALLEGRO_COLOR color, const ALLEGRO_FONT *font)
+{
+	clear();
+	addText(text, color, font);
+}
+
+void TGUITextLayout::setColor(ALLEGRO_COLOR color)
+{
+	for (size_t i = 0; i < spans.size(); i++) {
+		if (!spans[i].icon)
+			spans[i].color = color;
+	}
+}
+
+void TGUITextLayout::setWidth(int width)
+{
+	if (width != this->width) {
+		this->width = width;
+		dirty = true;
+	}
+}
+
+void TGUITextLayout::setAlignment(int align)
+{
+	if (align != this->align) {
+		this->align = align;
+		dirty = true;
+	}
+}
+
+int TGUITextLayout::getWidth()
+{
+	layout();
+	return layoutWidth;
+}
+
+int TGUITextLayout::getHeight()
+{
+	layout();
+	return layoutHeight;
+}
+
+int TGUITextLayout::getNumLines()
+{
+	layout();
+	return numLines;
+}
+
+int TGUITextLayout::getLineTop(int line)
+{
+	layout();
+	if (line >= numLines)
+		return layoutHeight;
+	return lineTops[line];
+}
+
+void TGUITextLayout::getGlyphs(std::vector<TGUIGlyph> &glyphs)
+{
+	layout();
+
+	int line = 0;
+	for (int i = 0; i < (int)runs.size(); i++) {
+		while (line+1 < numLines && lineFirstRuns[line+1] <= i)
+			line++;
+
+		const Run &r = runs[i];
+		const Span &s = spans[r.span];
+
+		TGUIGlyph g;
+		g.x = r.x;
+		g.y = r.y;
+		g.line = line;
+		g.icon = s.icon;
+		g.font = s.icon ? NULL : spanFont(r.span);
+		g.color = s.color;
+
+		if (s.icon) {
+			g.code_point = -1;
+			glyphs.push_back(g);
+			continue;
+		}
+
+		size_t pos = 0;
+		int cp;
+		while ((cp = utf8Next(r.text.c_str(), &pos)) >= 0) {
+			g.code_point = cp;
+			glyphs.push_back(g);
+			g.x += getCodePointAdvance(g.font, cp);
+		}
+	}
+}
+
+void TGUITextLayout::draw(float x, float y)
+{
+	layout();
+
+	for (size_t i = 0; i < runs.size(); i++) {
+		const Run &r = runs[i];
+		const Span &s = spans[r.span];
+		if (s.icon)
+			al_draw_bitmap(s.icon, x+r.x, y+r.y, 0);
+		else
+			drawText(spanFont(r.span), s.color, x+r.x, y+r.y, 0, r.text);
+	}
+}
+
+const ALLEGRO_FONT *TGUITextLayout::spanFont(int span)
+{
+	return spans[span].font ? spans[span].font : layoutFont;
+}
+
+// Width of the word going on from the end of span into the spans after
+// it, so a word isn't split where its colour changes
+int TGUITextLayout::wordTail(int span)
+{
+	int w = 0;
+	for (int i = span+1; i < (int)spans.size(); i++) {
+		const ALLEGRO_FONT *font = spanFont(i);
+		if (spans[i].icon || !font)
+			break;
+		const std::string &t = spans[i].text;
+		size_t end = t.find_first_of(" \n");
+		w += getTextWidth(font, t.substr(0, end));
+		if (end != std::string::npos)
+			break;
+	}
+	return w;
+}
+
+void TGUITextLayout::addRun(int span, int start, int end, int width, int ascent, int descent)
+{
+	penX += width;
+	lineAscent = std::max(lineAscent, ascent);
+	lineDescent = std::max(lineDescent, descent);
+
+	// more of the same span along the line goes in the same run
+	if ((int)runs.size() > lineStart) {
+		Run &last = runs.back();
+		if (last.span == span && last.end == start) {
+			last.end = end;
+			last.width += width;
+			return;
+		}
+	}
+
+	Run r;
+	r.span = span;
+	r.start = start;
+	r.end = end;
+	r.x = penX - width;
+	r.y = 0;
+	r.width = width;
+	r.ascent = ascent;
+	runs.push_back(r);
+}
+
+// ascent and descent are for an empty line
+void TGUITextLayout::endLine(int ascent, int descent)
+{
+	if (lineStart == (int)runs.size()) {
+		lineAscent = ascent;
+		lineDescent = descent;
+	}
+
+	int baseline = layoutHeight + lineAscent;
+	for (size_t i = lineStart; i < runs.size(); i++) {
+		runs[i].y = baseline - runs[i].ascent;
+	}
+
+	lineWidths.push_back(lineWidth);
+	lineFirstRuns.push_back(lineStart);
+	lineTops.push_back(layoutHeight);
+	layoutWidth = std::max(layoutWidth, lineWidth);
+	layoutHeight += lineAscent + lineDescent;
+	numLines++;
+
+	penX = 0;
+	lineWidth = 0;
+	lineStart = runs.size();
+	lineAscent = 0;
+	lineDescent = 0;
+}
+
+void TGUITextLayout::layout()
+{
+	if (!dirty && layoutFont == getFont())
+		return;
+
+	dirty = false;
+	layoutFont = getFont();
+
+	runs.clear();
+	lineWidths.clear();
+	lineFirstRuns.clear();
+	lineTops.clear();
+	numLines = 0;
+	layoutWidth = 0;
+	layoutHeight = 0;
+	penX = 0;
+	lineWidth = 0;
+	lineStart = 0;
+	lineAscent = 0;
+	lineDescent = 0;
+
+	int ascent = 0;
+	int descent = 0;
+	// the last run ended part way through a word that was already fitted
+	bool inWord = false;
+
+	for (int i = 0; i < (int)spans.size(); i++) {
+		const Span &s = spans[i];
+
+		if (s.icon) {
+			int w = al_get_bitmap_width(s.icon);
+			if (width > 0 && penX > 0 && penX + w > width) {
+				endLine(ascent, descent);
+			}
+			addRun(i, 0, 0, w, al_get_bitmap_height(s.icon), 0);
+			lineWidth = penX;
+			inWord = false;
+			continue;
+		}
+
+		const ALLEGRO_FONT *font = spanFont(i);
+		if (!font)
+			continue;
+
+		ascent = al_get_font_ascent(font);
+		descent = getLineHeight(font) - ascent;
+
+		const std::string &t = s.text;
+		size_t pos = 0;
+		while (pos < t.length()) {
+			size_t end = pos;
+
+			if (t[pos] == '\n') {
+				endLine(ascent, descent);
+				inWord = false;
+				pos++;
+				continue;
+			}
+
+			if (t[pos] == ' ') {
+				while (end < t.length() && t[end] == ' ')
+					end++;
+				// trailing spaces don't count towards the line width
+				addRun(i, pos, end, getTextWidth(font, t.substr(pos, end-pos)), ascent, descent);
+				inWord = false;
+				pos = end;
+				continue;
+			}
+
+			while (end < t.length() && t[end] != ' ' && t[end] != '\n')
+				end++;
+
+			int w = getTextWidth(font, t.substr(pos, end-pos));
+
+			if (width > 0 && !(pos == 0 && inWord)) {
+				int whole = w;
+				if (end == t.length())
+					whole += wordTail(i);
+				if (lineWidth > 0 && penX + whole > width) {
+					endLine(ascent, descent);
+				}
+			}
+
+			if (width > 0 && penX + w > width && penX == 0) {
+				// too long for a line, as many code points as fit
+				// on each (at least one)
+				while (pos < end) {
+					size_t p = pos;
+					int ww = 0;
+					while (p < end) {
+						size_t q = p;
+						int a = getCodePointAdvance(font, utf8Next(t.c_str(), &q));
+						if (ww + a > width && p > pos)
+							break;
+						ww += a;
+						p = q;
+					}
+					addRun(i, pos, p, ww, ascent, descent);
+					lineWidth = penX;
+					pos = p;
+					if (pos < end) {
+						endLine(ascent, descent);
+					}
+				}
+			}
+			else {
+				addRun(i, pos, end, w, ascent, descent);
+				lineWidth = penX;
+			}
+
+			inWord = end == t.length();
+			pos = end;
+		}
+	}
+
+	if (!spans.empty()) {
+		endLine(ascent, descent);
+	}
+
+	int box = width > 0 ? width : layoutWidth;
+	for (int l = 0; l < numLines; l++) {
+		int offset = 0;
+		if (align & ALLEGRO_ALIGN_CENTRE)
+			offset = (box - lineWidths[l]) / 2;
+		else if (align & ALLEGRO_ALIGN_RIGHT)
+			offset = box - lineWidths[l];
+		int end = l+1 < numLines ? lineFirstRuns[l+1] : runs.size();
+		for (int i = lineFirstRuns[l]; i < end; i++) {
+			runs[i].x += offset;
+		}
+	}
+
+	for (size_t i = 0; i < runs.size(); i++) {
+		Run &r = runs[i];
+		r.text = spans[r.span].text.substr(r.start, r.end-r.start);
+	}
+}
+
+TGUITextLayout::TGUITextLayout() :
+	width(0),
+	align(ALLEGRO_ALIGN_LEFT),
+	dirty(true),
+	layoutFont(NULL),
+	numLines(0),
+	layoutWidth(0),
+	layoutHeight(0)
+{
+}
+
+static TGUITextLayout *getWrappedText(const ALLEGRO_FONT *font, int width, int flags, const std::string &text)
+{
+	typedef std::multimap<std::string, TGUIWrappedText>::iterator Iter;
+
+	std::pair<Iter, Iter> range = wrappedTexts.equal_range(text);
+	for (Iter it = range.first; it != range.second; it++) {
+		TGUIWrappedText &w = it->second;
+		if (w.font == font && w.width == width && w.flags == flags) {
+			w.last_used = runClock++;
+			return &w.layout;
+		}
+	}
+
+	if (wrappedTexts.size() >= MAX_WRAPPED_TEXTS) {
+		Iter oldest = wrappedTexts.begin();
+		for (Iter it = wrappedTexts.begin(); it != wrappedTexts.end(); it++) {
+			if (it->second.last_used < oldest->second.last_used)
+				oldest = it;
+		}
+		wrappedTexts.erase(oldest);
+	}
+
+	TGUIWrappedText &w = wrappedTexts.insert(std::make_pair(text, TGUIWrappedText()))->second;
+	w.font = font;
+	w.width = width;
+	w.flags = flags;
+	w.last_used = runClock++;
+	w.layout.setText(text, al_map_rgb(0xff, 0xff, 0xff), font);
+	w.layout.setWidth(width);
+	w.layout.setAlignment(flags);
+	return &w.layout;
+}
+
+void drawWrappedText(const ALLEGRO_FONT *font, ALLEGRO_COLOR color, float x, float y, int width, int flags, const std::string &text)
+{
+	TGUITextLayout *layout = getWrappedText(font, width, flags, text);
+	layout->setColor(color);
+	layout->draw(x, y);
+}
+
+void getWrappedTextSize(const ALLEGRO_FONT *font, int width, int flags, const std::string &text, int *w, int *h)
+{
+	TGUITextLayout *layout = getWrappedText(font, width, flags, text);
+	*w = layout->getWidth();
+	*h = layout->getHeight();
+}
+
+int TGUIGapBuffer::nextCodePoint(int *pos) const
+{
+	int len = length();
+	char s[5];
+	int n = 0;
+	for (; n < 4 && *pos+n < len; n++) {
+		s[n] = at(*pos+n);
+	}
+	s[n] = 0;
+
+	size_t p = 0;
+	int cp = utf8Next(s, &p);
+	*pos += p;
+
+	return cp;
+}
+
+std::string TGUIGapBuffer::substr(int pos, int len) const
+{
+	std::string s;
+	copy(pos, len, s);
+	return s;
+}
+
+void TGUIGapBuffer::copy(int pos, int len, std::string &s) const
+{
+	s.clear();
+	if (len <= 0)
+		return;
+	s.reserve(len);
+
+	// the parts before and after the gap
+	int end = pos + len;
+	if (pos < gap_start)
+		s.append(&data[0] + pos, std::min(end, gap_start) - pos);
+	if (end > gap_start) {
+		int from = std::max(pos, gap_start);
+		s.append(&data[0] + from + gap_end - gap_start, end - from);
+	}
+}
+
+std::string TGUIGapBuffer::str() const
+{
+	std::string s;
+	s.reserve(length());
+	s.append(data.begin(), data.begin()+gap_start);
+	s.append(data.begin()+gap_end, data.end());
+	return s;
+}
+
+void TGUIGapBuffer::moveGap(int pos)
+{
+	int gap = gap_end - gap_start;
+
+	if (pos < gap_start) {
+		int n = gap_start - pos;
+		memmove(&data[0] + pos + gap, &data[0] + pos, n);
+	}
+	else if (pos > gap_start) {
+		int n = pos - gap_start;
+		memmove(&data[0] + gap_start, &data[0] + gap_end, n);
+	}
+
+	gap_start = pos;
+	gap_end = pos + gap;
+}
+
+void TGUIGapBuffer::growGap(int len)
+{
+	int gap = gap_end - gap_start;
+	if (gap >= len)
+		return;
+
+	int after = data.size() - gap_end;
+	int new_gap = std::max(len, (int)data.size()) + 16;
+
+	std::vector<char> grown(gap_start + new_gap + after);
+	std::copy(data.begin(), data.begin()+gap_start, grown.begin());
+	std::copy(data.begin()+gap_end, data.end(), grown.begin()+gap_start+new_gap);
+
+	data.swap(grown);
+	gap_end = gap_start + new_gap;
+}
+
+void TGUIGapBuffer::insert(int pos, const char *text, int len)
+{
+	if (len <= 0)
+		return;
+
+	moveGap(pos);
+	growGap(len);
+	memcpy(&data[0] + gap_start, text, len);
+	gap_start += len;
+}
+
+void TGUIGapBuffer::erase(int pos, int len)
+{
+	moveGap(pos);
+	gap_end += len;
+}
+
+void TGUIGapBuffer::assign(const std::string &s)
+{
+	data.assign(s.begin(), s.end());
+	gap_start = gap_end = data.size();
+}
+
+TGUIGapBuffer::TGUIGapBuffer() :
+	gap_start(0),
+	gap_end(0)
+{
+}
+
+// Index of the piece holding byte pos, pieces.size() at the end
+int TGUIPieceTable::findPiece(int pos, int *piece_start) const
+{
+	int i = 0;
+	int start = 0;
+	if (hint < (int)pieces.size() && hint_start <= pos) {
+		i = hint;
+		start = hint_start;
+	}
+
+	for (; i < (int)pieces.size(); i++) {
+		if (pos < start + pieces[i].length)
+			break;
+		start += pieces[i].length;
+	}
+
+	hint = i;
+	hint_start = start;
+	*piece_start = start;
+	return i;
+}
+
+// Makes pos the start of a piece and returns its index
+int TGUIPieceTable::split(int pos)
+{
+	int start;
+	int i = findPiece(pos, &start);
+	if (i >= (int)pieces.size() || pos == start)
+		return i;
+
+	Piece second = pieces[i];
+	int n = pos - start;
+	second.start += n;
+	second.length -= n;
+	pieces[i].length = n;
+	pieces.insert(pieces.begin()+i+1, second);
+
+	hint = i+1;
+	hint_start = pos;
+	return i+1;
+}
+
+std::string TGUIPieceTable::substr(int pos, int len) const
+{
+	std::string s;
+	copy(pos, len, s);
+	return s;
+}
+
+void TGUIPieceTable::copy(int pos, int len, std::string &s) const
+{
+	s.clear();
+	if (len <= 0)
+		return;
+	s.reserve(len);
+
+	int start;
+	int i = findPiece(pos, &start);
+	for (; i < (int)pieces.size() && len > 0; i++) {
+		const Piece &p = pieces[i];
+		const std::string &buf = p.added ? added : original;
+		int skip = pos - start;
+		int n = std::min(p.length - skip, len);
+		s.append(buf, p.start + skip, n);
+		len -= n;
+		pos += n;
+		start += p.length;
+	}
+}
+
+const char *TGUIPieceTable::chunk(int pos, int *len) const
+{
+	int start;
+	int i = findPiece(pos, &start);
+	if (i >= (int)pieces.size()) {
+		*len = 0;
+		return NULL;
+	}
+
+	const Piece &p = pieces[i];
+	const std::string &buf = p.added ? added : original;
+	*len = p.length - (pos - start);
+	return buf.data() + p.start + (pos - start);
+}
+
+std::string TGUIPieceTable::str() const
+{
+	return substr(0, total);
+}
+
+void TGUIPieceTable::insert(int pos, const char *text, int len)
+{
+	if (len <= 0)
+		return;
+
+	int added_start = added.length();
+	added.append(text, len);
+	total += len;
+
+	int i = split(pos);
+
+	// typing on from the last insert just makes that piece longer
+	if (i > 0) {
+		Piece &prev = pieces[i-1];
+		if (prev.added && prev.start + prev.length == added_start) {
+			prev.length += len;
+			hint = i-1;
+			hint_start = pos - (prev.length - len);
+			return;
+		}
+	}
+
+	Piece p;
+	p.added = true;
+	p.start = added_start;
+	p.length = len;
+	pieces.insert(pieces.begin()+i, p);
+
+	hint = i;
+	hint_start = pos;
+}
+
+void TGUIPieceTable::erase(int pos, int len)
+{
+	if (len <= 0)
+		return;
+
+	int first = split(pos);
+	int last = split(pos + len);
+	pieces.erase(pieces.begin()+first, pieces.begin()+last);
+	total -= len;
+
+	hint = first;
+	hint_start = pos;
+}
+
+void TGUIPieceTable::assign(const std::string &s)
+{
+	original = s;
+	added.clear();
+	pieces.clear();
+	total = s.length();
+	hint = 0;
+	hint_start = 0;
+
+	if (total > 0) {
+		Piece p;
+		p.added = false;
+		p.start = 0;
+		p.length = total;
+		pieces.push_back(p);
+	}
+}
+
+TGUIPieceTable::TGUIPieceTable() :
+	total(0),
+	hint(0),
+	hint_start(0)
+{
+}
+
+} // End namespace tgui
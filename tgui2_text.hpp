@@ -0,0 +1,247 @@
+#ifndef TGUI_TEXT_H
+#define TGUI_TEXT_H
+
+#include "tgui2.hpp"
+
+#include <string>
+
+namespace tgui {
+
+// Next code point of a UTF-8 string starting at byte *pos, which is moved
+// past it. -1 at the end. Bad bytes are skipped.
+int utf8Next(const char *s, size_t *pos);
+// Same, reading no further than byte end (for text that isn't
+// NUL-terminated)
+int utf8Next(const char *s, size_t *pos, size_t end);
+std::string utf8Encode(int code_point);
+
+// Cached text metrics. String widths are remembered per font (the cache
+// is dropped when it gets big), and for fonts whose printable ASCII
+// glyphs all have the same advance, ASCII strings are measured by
+// counting. Call forgetFont() before destroying a font that was measured
+// (another font could get the same address).
+int getTextWidth(const ALLEGRO_FONT *font, const std::string &text);
+int getTextWidth(const ALLEGRO_FONT *font, const char *text);
+int getLineHeight(const ALLEGRO_FONT *font);
+// advance of a printable ASCII character, -1 for anything else
+int getGlyphAdvance(const ALLEGRO_FONT *font, int c);
+// advance of any code point (cached like getTextWidth past ASCII)
+int getCodePointAdvance(const ALLEGRO_FONT *font, int code_point);
+bool isMonospace(const ALLEGRO_FONT *font);
+void forgetFont(const ALLEGRO_FONT *font);
+void forgetAllFonts();
+
+// Like al_draw_text. With text caching on, each string is rendered once
+// per font to a bitmap in white and drawn tinted after that, so a new
+// text or font makes a new bitmap and a new colour doesn't. The least
+// recently drawn are thrown out past a limit. Text drawn with a scaled
+// or rotated transform isn't cached, so zoomed views stay sharp.
+void drawText(const ALLEGRO_FONT *font, ALLEGRO_COLOR color, float x, float y, int flags, const std::string &text);
+void setTextCaching(bool cache);
+bool getTextCaching();
+
+// Left aligned text drawn glyph by glyph, only the glyphs inside the
+// clipping rectangle: cached advances walk past the ones before it and
+// drawing stops at its far edge, so a long line costs about what shows
+// and nothing is allocated. Kerning is ignored. length is in bytes (-1
+// for all of it). Returns the x after the text, which is only exact up
+// to where drawing stopped.
+float drawClippedText(const ALLEGRO_FONT *font, ALLEGRO_COLOR color, float x, float y, const char *text, int length = -1);
+// The advances drawClippedText steps by, added up (so no kerning)
+int getTextAdvance(const ALLEGRO_FONT *font, const char *text, int length = -1);
+
+// Rasterises the glyphs of charset (UTF-8) ahead of time, so the first
+// menu showing them doesn't hitch. Call it from the thread that draws
+// with the font.
+void prewarmFont(ALLEGRO_FONT *font, const char *charset);
+
+// Loads a TTF font as a bitmap font with just the characters in charset.
+// The glyph atlas is baked once and saved in cache_dir (NULL for none,
+// needs an image addon that can save PNG), later calls load the atlas
+// instead of running FreeType. Baked fonts have no kerning. Clear
+// cache_dir when the font file changes.
+ALLEGRO_FONT *loadBakedFont(const char *filename, int size, int flags, const char *charset, const char *cache_dir);
+// loadBakedFont on a thread, so startup doesn't wait on FreeType. The
+// thread loads its own copy of the TTF and bakes into memory bitmaps
+// nothing else uses; once isPrewarming() returns false (it makes the font,
+// on the thread calling it) takeBakedFont() hands the font over, NULL if
+// it couldn't be loaded. One at a time: starting another waits for the
+// last and destroys its font if it wasn't taken. forgetAllFonts() (and
+// so tgui::shutdown()) waits for it too.
+void loadBakedFontInBackground(const char *filename, int size, int flags, const char *charset, const char *cache_dir);
+bool isPrewarming();
+ALLEGRO_FONT *takeBakedFont();
+
+// One code point (or icon) of a TGUITextLayout, for drawing part of it
+struct TGUIGlyph {
+	int code_point; // -1 for an icon
+	int x; // top left, from the layout's
+	int y;
+	int line;
+	const ALLEGRO_FONT *font;
+	ALLEGRO_BITMAP *icon;
+	ALLEGRO_COLOR color;
+};
+
+// Rich text wrapped to a width: spans with their own colour and font,
+// and inline icons, sitting on a shared baseline. Line breaks and run
+// widths are worked out again only when the content, width, alignment or
+// gui font changes, not on every draw, and the runs go through drawText
+// so text caching applies to them. '\n' always starts a new line; a
+// word too long for the width is broken anywhere.
+class TGUITextLayout {
+public:
+	void clear();
+	// font NULL for the gui font when drawn
+	void addText(const std::string &text, ALLEGRO_COLOR color, const ALLEGRO_FONT *font = NULL);
+	void addIcon(ALLEGRO_BITMAP *icon);
+	void setText(const std::string &text, ALLEGRO_COLOR color, const ALLEGRO_FONT *font = NULL);
+	// every span, without laying out again
+	void setColor(ALLEGRO_COLOR color);
+
+	// 0 for no wrapping
+	void setWidth(int width);
+	// ALLEGRO_ALIGN_LEFT, _CENTRE or _RIGHT, inside the width (the widest
+	// line without one)
+	void setAlignment(int align);
+
+	// of the laid out text
+	int getWidth();
+	int getHeight();
+	int getNumLines();
+	// getLineTop(getNumLines()) is the height
+	int getLineTop(int line);
+	// every glyph in order, spaces included, not newlines
+	void getGlyphs(std::vector<TGUIGlyph> &glyphs);
+
+	void draw(float x, float y);
+
+	TGUITextLayout();
+
+protected:
+	struct Span {
+		std::string text;
+		ALLEGRO_COLOR color;
+		const ALLEGRO_FONT *font;
+		ALLEGRO_BITMAP *icon;
+	};
+
+	// Part of one span on one line, x and y from the top left
+	struct Run {
+		int span;
+		int start; // bytes in the span
+		int end;
+		int x;
+		int y;
+		int width;
+		int ascent;
+		std::string text;
+	};
+
+	void layout();
+	const ALLEGRO_FONT *spanFont(int span);
+	int wordTail(int span);
+	void addRun(int span, int start, int end, int width, int ascent, int descent);
+	void endLine(int ascent, int descent);
+
+	std::vector<Span> spans;
+	std::vector<Run> runs;
+	int width;
+	int align;
+	bool dirty;
+	const ALLEGRO_FONT *layoutFont;
+
+	// results, and the line being filled during layout()
+	int numLines;
+	int layoutWidth;
+	int layoutHeight;
+	int penX;
+	int lineWidth; // to the end of the last word
+	int lineStart; // first run
+	int lineAscent;
+	int lineDescent;
+	std::vector<int> lineWidths;
+	std::vector<int> lineFirstRuns;
+	std::vector<int> lineTops;
+};
+
+// One colour of wrapped text from a cache of layouts keyed by the text,
+// font, width and alignment flags, for widgets drawing the same
+// paragraphs every frame. The least recently used go past a limit.
+void drawWrappedText(const ALLEGRO_FONT *font, ALLEGRO_COLOR color, float x, float y, int width, int flags, const std::string &text);
+void getWrappedTextSize(const ALLEGRO_FONT *font, int width, int flags, const std::string &text, int *w, int *h);
+
+// Text with a movable gap at the last edit, so repeated edits in one
+// place (typing, pasting) don't move the rest of the text each time.
+// Positions are in bytes.
+class TGUIGapBuffer {
+public:
+	int length() const { return data.size() - (gap_end - gap_start); }
+	char at(int pos) const {
+		return pos < gap_start ? data[pos] : data[pos + gap_end - gap_start];
+	}
+	// next UTF-8 code point at *pos, like utf8Next
+	int nextCodePoint(int *pos) const;
+	std::string substr(int pos, int len) const;
+	// like substr into out, which keeps its capacity between calls
+	void copy(int pos, int len, std::string &out) const;
+	std::string str() const;
+
+	void insert(int pos, const char *text, int len);
+	void erase(int pos, int len);
+	void assign(const std::string &s);
+
+	TGUIGapBuffer();
+
+protected:
+	void moveGap(int pos);
+	void growGap(int len);
+
+	std::vector<char> data;
+	int gap_start;
+	int gap_end;
+};
+
+// Text as pieces of the original and of an append-only buffer of added
+// text, so an edit costs about the same wherever it is in a big text.
+// Typing at one place grows one piece. Positions are in bytes.
+class TGUIPieceTable {
+public:
+	int length() const { return total; }
+	std::string substr(int pos, int len) const;
+	// like substr into out, which keeps its capacity between calls
+	void copy(int pos, int len, std::string &out) const;
+	// The bytes from pos to the end of the piece holding it, in place:
+	// *len of them, 0 at the end. Valid until the next edit.
+	const char *chunk(int pos, int *len) const;
+	std::string str() const;
+
+	void insert(int pos, const char *text, int len);
+	void erase(int pos, int len);
+	void assign(const std::string &s);
+
+	TGUIPieceTable();
+
+protected:
+	struct Piece {
+		bool added;
+		int start;
+		int length;
+	};
+
+	int findPiece(int pos, int *piece_start) const;
+	int split(int pos);
+
+	std::string original;
+	std::string added;
+	std::vector<Piece> pieces;
+	int total;
+	// last piece found and where it starts, edits are usually close
+	// together
+	mutable int hint;
+	mutable int hint_start;
+};
+
+} // End namespace tgui
+
+#endif
@@ -6,11 +6,12 @@
 
 #include "tgui2.hpp"
 #include "tgui2_widgets.hpp"
+#include "tgui2_text.hpp"
 
 #include <cstdio>
 
 
-static void getVisibleSubMenus(TGUI_Splitter *root, std::vector<TGUI_SubMenuItem *> &subMenus, int depth, int maxDepth);
+static void getVisibleSubMenus(TGUI_Splitter *root, std::vector<tgui::TGUIWidget *> &subMenus, int depth, int maxDepth);
 
 static ALLEGRO_COLOR fore;
 static ALLEGRO_COLOR back;
@@ -66,6 +67,8 @@ void TGUI_Checkbox::setChecked(bool checked)
 
 TGUI_Checkbox::TGUI_Checkbox(int x, int y, int w, int h, bool checked)
 {
+	setPositionsChildren(false);
+
 	this->x = x;
 	this->y = y;
 	this->width = w;
@@ -137,6 +140,8 @@ TGUI_Icon::TGUI_Icon(ALLEGRO_BITMAP *image, int x, int y, int flags) :
 	image(image),
 	clicked(false)
 {
+	setPositionsChildren(false);
+
 	this->x = x;
 	this->y = y;
 	if (image) {
@@ -204,6 +209,110 @@ void TGUI_Splitter::addCollidingChildrenToVector(std::vector<tgui::TGUIWidget *>
 	}
 }
 
+void TGUI_Splitter::updateOffsets()
+{
+	offsets.resize(sizes.size()+1);
+	offsets[0] = 0;
+	for (size_t i = 0; i < sizes.size(); i++) {
+		offsets[i+1] = offsets[i] + sizes[i];
+	}
+}
+
+void TGUI_Splitter::getSectionOffset(int section, int *xx, int *yy)
+{
+	if (direction == TGUI_VERTICAL) {
+		*xx = 0;
+		*yy = offsets[section];
+	}
+	else {
+		*xx = offsets[section];
+		*yy = 0;
+	}
+}
+
+// Sections [*first, *end) are the only ones whose grip or content area can
+// contain the point (ranges are inclusive so neighbours share an edge)
+void TGUI_Splitter::findSections(int rel_x, int rel_y, int *first, int *end)
+{
+	int pos = direction == TGUI_VERTICAL ? rel_y : rel_x;
+	int n = sizes.size();
+
+	int i = std::lower_bound(offsets.begin()+1, offsets.end(), pos) - (offsets.begin()+1);
+	*first = i;
+	while (i < n && (offsets[i] <= pos || offsets[i+1]-5 <= pos)) {
+		i++;
+	}
+	*end = i;
+}
+
+bool TGUI_Splitter::inSectionGrip(int section, int rel_x, int rel_y)
+{
+	if (section >= (int)widgets.size()-1 || !section_is_resizable[section]) {
+		return false;
+	}
+
+	int along, across, across_size;
+	if (direction == TGUI_VERTICAL) {
+		along = rel_y;
+		across = rel_x;
+		across_size = width;
+	}
+	else {
+		along = rel_x;
+		across = rel_y;
+		across_size = height;
+	}
+
+	int end = offsets[section+1];
+
+	return across >= 0 && across <= across_size &&
+		along >= end-5 && along <= end;
+}
+
+bool TGUI_Splitter::inSectionContent(int section, int rel_x, int rel_y)
+{
+	if (!widgets[section]) {
+		return false;
+	}
+
+	int along, across, across_size, along_pad, across_pad;
+	if (direction == TGUI_VERTICAL) {
+		along = rel_y;
+		across = rel_x;
+		across_size = width;
+		along_pad = vpadding;
+		across_pad = hpadding;
+	}
+	else {
+		along = rel_x;
+		across = rel_y;
+		across_size = height;
+		along_pad = hpadding;
+		across_pad = vpadding;
+	}
+
+	return across >= across_pad && across <= across_size-across_pad &&
+		along >= offsets[section]+along_pad &&
+		along <= offsets[section+1]-along_pad;
+}
+
+bool TGUI_Splitter::overSectionWidget(int section, int rel_x, int rel_y)
+{
+	TGUIWidget *widget = widgets[section];
+
+	if (((TGUI_Extended_Widget *)widget)->getTamperingEnabled()) {
+		return true;
+	}
+
+	int xx, yy;
+	getSectionOffset(section, &xx, &yy);
+
+	return rel_x >= xx+widget->getX() &&
+		rel_x <= xx+widget->getX()+widget->getWidth() &&
+		rel_y >= yy+widget->getY() &&
+		rel_y <= yy+widget->getY()+widget->getHeight();
+}
+
 bool TGUI_Splitter::getAbsoluteChildPosition(tgui::TGUIWidget *widget, int *x, int *y)
 {
 	for (size_t i = 0; i < widgets.size(); i++) {
@@ -214,18 +323,8 @@ bool TGUI_Splitter::getAbsoluteChildPosition(tgui::TGUIWidget *widget, int *x, i
 			int own_x, own_y;
 			tgui::determineAbsolutePosition(this, &own_x, &own_y);
 
-			int xx = 0;
-			int yy = 0;
-			if (direction == TGUI_HORIZONTAL) {
-				for (size_t j = 0; j < i; j++) {
-					xx += sizes[j];
-				}
-			}
-			else {
-				for (size_t j = 0; j < i; j++) {
-					yy += sizes[j];
-				}
-			}
+			int xx, yy;
+			getSectionOffset(i, &xx, &yy);
 			*x = own_x + xx + widget->getX();
 			*y = own_y + yy + widget->getY();
 
@@ -247,12 +346,20 @@ bool TGUI_Splitter::getAbsoluteChildPosition(tgui::TGUIWidget *widget, int *x, i
 
 void TGUI_Splitter::setWidth(int w)
 {
-	width = w;
+	if (w != width) {
+		width = w;
+		tgui::invalidateBounds();
+		invalidateLayout();
+	}
 }
 
 void TGUI_Splitter::setHeight(int h)
 {
-	height = h;
+	if (h != height) {
+		height = h;
+		tgui::invalidateBounds();
+		invalidateLayout();
+	}
 }
 
 void TGUI_Splitter::keyDown(int keycode)
@@ -370,19 +477,18 @@ void TGUI_Splitter::draw(int abs_x, int abs_y)
 	for (unsigned int i = 0; i < widgets.size(); i++) {
 		TGUIWidget *widget = widgets[i];
 
-		int w, h, xinc, yinc;
+		int w, h, ox, oy;
 		if (direction == TGUI_VERTICAL) {
 			w = width;
 			h = sizes[i];
-			xinc = 0;
-			yinc = h;
 		}
 		else {
 			w = sizes[i];
 			h = height;
-			xinc = w;
-			yinc = 0;
 		}
+		getSectionOffset(i, &ox, &oy);
+		xx = abs_x + ox;
+		yy = abs_y + oy;
 
 		int _x, _y, _w, _h;
 		al_get_clipping_rectangle(&_x, &_y, &_w, &_h);
@@ -402,9 +508,6 @@ void TGUI_Splitter::draw(int abs_x, int abs_y)
 		}
 
 		al_set_clipping_rectangle(_x, _y, _w, _h);
-
-		xx += xinc;
-		yy += yinc;
 	}
 }
 
@@ -415,192 +518,76 @@ void TGUI_Splitter::mouseUp(int rel_x, int rel_y, int abs_x, int abs_y, int mb)
 		return;
 	}
 
-	bool used;
+	bool used = rel_x < 0 || rel_y < 0;
 
-	if (rel_x < 0 || rel_y < 0)
-		used = true;
-	else
-		used = false;
-	
-	int xx = 0;
-	int yy = 0;
+	int first, end;
+	findSections(rel_x, rel_y, &first, &end);
 
-	for (unsigned int i = 0; i < widgets.size(); i++) {
+	for (int i = 0; i < (int)widgets.size(); i++) {
 		TGUIWidget *widget = widgets[i];
 
-		if (direction == TGUI_VERTICAL) {
-			if (!used &&
-					rel_x >= xx+hpadding &&
-					rel_x <= xx+width-hpadding &&
-					rel_y >= yy+vpadding &&
-					rel_y <= yy+sizes[i]-vpadding &&
-					widget
-			) {
-				if (((TGUI_Extended_Widget *)widget)->getTamperingEnabled() ||
-					(rel_x >= xx+widget->getX() &&
-					rel_x <= xx+widget->getX()+widget->getWidth() &&
-					rel_y >= yy+widget->getY() &&
-					rel_y <= yy+widget->getY()+widget->getHeight())) {
-					widget->mouseUp(
-						rel_x-xx,
-						rel_y-yy,
-						abs_x,
-						abs_y,
-						mb
-					);
-					used = true;
-				}
-			}
-			else if (widget) {
+		if (!used && i >= first && i < end && inSectionContent(i, rel_x, rel_y)) {
+			if (overSectionWidget(i, rel_x, rel_y)) {
+				int xx, yy;
+				getSectionOffset(i, &xx, &yy);
 				widget->mouseUp(
-					-1, -1,
-					abs_x, abs_y,
+					rel_x-xx,
+					rel_y-yy,
+					abs_x,
+					abs_y,
 					mb
 				);
+				used = true;
 			}
-			yy += sizes[i];
 		}
-		else {
-			if (!used &&
-					rel_x >= xx+hpadding &&
-					rel_x <= xx+sizes[i]-hpadding &&
-					rel_y >= yy+vpadding &&
-					rel_y <= yy+height-vpadding &&
-					widget
-			) {
-				if (((TGUI_Extended_Widget *)widget)->getTamperingEnabled() ||
-					(rel_x >= xx+widget->getX() &&
-					rel_x <= xx+widget->getX()+widget->getWidth() &&
-					rel_y >= yy+widget->getY() &&
-					rel_y <= yy+widget->getY()+widget->getHeight())) {
-					widget->mouseUp(
-						rel_x-xx,
-						rel_y-yy,
-						abs_x,
-						abs_y,
-						mb
-					);
-					used = true;
-				}
-			}
-			else if (widget) {
-				widget->mouseUp(
-					-1, -1,
-					abs_x, abs_y,
-					mb
-				);
-			}
-			xx += sizes[i];
+		else if (widget) {
+			widget->mouseUp(
+				-1, -1,
+				abs_x, abs_y,
+				mb
+			);
 		}
 	}
 }
 
 void TGUI_Splitter::mouseDown(int rel_x, int rel_y, int abs_x, int abs_y, int mb)
 {
-	bool used;
+	bool used = rel_x < 0 || rel_y < 0;
 
-	if (rel_x < 0 || rel_y < 0)
-		used = true;
-	else
-		used = false;
-	
-	int xx = 0;
-	int yy = 0;
+	int first, end;
+	findSections(rel_x, rel_y, &first, &end);
 
-	for (unsigned int i = 0; i < widgets.size(); i++) {
+	for (int i = 0; i < (int)widgets.size(); i++) {
 		TGUIWidget *widget = widgets[i];
+		bool candidate = !used && i >= first && i < end;
 
-		if (direction == TGUI_VERTICAL) {
-			if (!used &&
-					rel_x >= xx &&
-					rel_x <= xx+width &&
-					rel_y >= yy+(sizes[i]-5) &&
-					rel_y <= yy+sizes[i] &&
-					i < (widgets.size()-1) &&
-					section_is_resizable[i]
-			) {
-				resizing = i;
-				last_resize_x = abs_x;
-				last_resize_y = abs_y;
-				used = true;
-			}
-			else if (!used &&
-					rel_x >= xx+hpadding &&
-					rel_x <= xx+width-hpadding &&
-					rel_y >= yy+vpadding &&
-					rel_y <= yy+sizes[i]-vpadding &&
-					widget
-			) {
-				if (((TGUI_Extended_Widget *)widget)->getTamperingEnabled() ||
-					(rel_x >= xx+widget->getX() &&
-					rel_x <= xx+widget->getX()+widget->getWidth() &&
-					rel_y >= yy+widget->getY() &&
-					rel_y <= yy+widget->getY()+widget->getHeight())) {
-					tgui::setFocus(widget);
-					widget->mouseDown(
-						rel_x-xx,
-						rel_y-yy,
-						abs_x,
-						abs_y,
-						mb
-					);
-					used = true;
-				}
-			}
-			else if (widget) {
-				widget->mouseDown(
-					-1, -1,
-					abs_x, abs_y,
-					mb
-				);
-			}
-			yy += sizes[i];
+		if (candidate && inSectionGrip(i, rel_x, rel_y)) {
+			resizing = i;
+			last_resize_x = abs_x;
+			last_resize_y = abs_y;
+			used = true;
 		}
-		else {
-			if (!used &&
-					rel_x >= xx+(sizes[i]-5) &&
-					rel_x <= xx+sizes[i] &&
-					rel_y >= yy &&
-					rel_y <= yy+height &&
-					i < (widgets.size()-1) &&
-					section_is_resizable[i]
-			) {
-				resizing = i;
-				last_resize_x = abs_x;
-				last_resize_y = abs_y;
-				used = true;
-			}
-			else if (!used &&
-					rel_x >= xx+hpadding &&
-					rel_x <= xx+sizes[i]-hpadding &&
-					rel_y >= yy+vpadding &&
-					rel_y <= yy+height-vpadding &&
-					widget
-			) {
-				if (((TGUI_Extended_Widget *)widget)->getTamperingEnabled() ||
-					(rel_x >= xx+widget->getX() &&
-					rel_x <= xx+widget->getX()+widget->getWidth() &&
-					rel_y >= yy+widget->getY() &&
-					rel_y <= yy+widget->getY()+widget->getHeight())) {
-					tgui::setFocus(widget);
-					widget->mouseDown(
-						rel_x-xx,
-						rel_y-yy,
-						abs_x,
-						abs_y,
-						mb
-					);
-					used = true;
-				}
-			}
-			else if (widget) {
+		else if (candidate && inSectionContent(i, rel_x, rel_y)) {
+			if (overSectionWidget(i, rel_x, rel_y)) {
+				int xx, yy;
+				getSectionOffset(i, &xx, &yy);
+				tgui::setFocus(widget);
 				widget->mouseDown(
-					-1, -1,
-					abs_x, abs_y,
+					rel_x-xx,
+					rel_y-yy,
+					abs_x,
+					abs_y,
 					mb
 				);
+				used = true;
 			}
-			xx += sizes[i];
+		}
+		else if (widget) {
+			widget->mouseDown(
+				-1, -1,
+				abs_x, abs_y,
+				mb
+			);
 		}
 	}
 }
@@ -686,115 +673,47 @@ void TGUI_Splitter::mouseMoveAll(tgui::TGUIWidget *leftOut, int abs_x, int abs_y
 
 void TGUI_Splitter::mouseMove(int rel_x, int rel_y, int abs_x, int abs_y)
 {
-	bool used;
+	bool used = rel_x < 0 || rel_y < 0;
 
-	if (rel_x < 0 || rel_y < 0)
-		used = true;
-	else
-		used = false;
+	int first, end;
+	findSections(rel_x, rel_y, &first, &end);
 
-	int xx = 0;
-	int yy = 0;
-	
-	for (unsigned int i = 0; i < widgets.size(); i++) {
+	for (int i = 0; i < (int)widgets.size(); i++) {
 		TGUIWidget *widget = widgets[i];
 
-		if (direction == TGUI_VERTICAL) {
-			if (!used &&
-					rel_x >= xx+hpadding &&
-					rel_x <= xx+width-hpadding &&
-					rel_y >= yy+vpadding &&
-					rel_y <= yy+sizes[i]-vpadding &&
-					widget
-			) {
-				static ALLEGRO_SYSTEM_MOUSE_CURSOR cursor = ALLEGRO_SYSTEM_MOUSE_CURSOR_DEFAULT;
-				ALLEGRO_SYSTEM_MOUSE_CURSOR current_cursor = cursor;
-				if (
-					i < widgets.size()-1 &&
-					section_is_resizable[i] &&
-					rel_y >= yy+(sizes[i]-5)
-				) {
-					current_cursor =
-					ALLEGRO_SYSTEM_MOUSE_CURSOR_RESIZE_S;
-				}
-				else {
-					current_cursor =
-					ALLEGRO_SYSTEM_MOUSE_CURSOR_DEFAULT;
-				}
-				if (cursor != current_cursor) {
-					al_set_system_mouse_cursor(tgui::getDisplay(), current_cursor);
-					cursor = current_cursor;
-				}
-				if (((TGUI_Extended_Widget *)widget)->getTamperingEnabled() ||
-					(rel_x >= xx+widget->getX() &&
-					rel_x <= xx+widget->getX()+widget->getWidth() &&
-					rel_y >= yy+widget->getY() &&
-					rel_y <= yy+widget->getY()+widget->getHeight())) {
-					widget->mouseMove(
-						rel_x-xx,
-						rel_y-yy,
-						abs_x,
-						abs_y
-					);
-					used = true;
-				}
+		if (!used && i >= first && i < end && inSectionContent(i, rel_x, rel_y)) {
+			static ALLEGRO_SYSTEM_MOUSE_CURSOR cursor = ALLEGRO_SYSTEM_MOUSE_CURSOR_DEFAULT;
+			ALLEGRO_SYSTEM_MOUSE_CURSOR current_cursor;
+			if (inSectionGrip(i, rel_x, rel_y)) {
+				current_cursor = direction == TGUI_VERTICAL ?
+					ALLEGRO_SYSTEM_MOUSE_CURSOR_RESIZE_S :
+					ALLEGRO_SYSTEM_MOUSE_CURSOR_RESIZE_E;
 			}
-			else if (widget) {
-				widget->mouseMove(
-					-1, -1,
-					abs_x, abs_y
-				);
+			else {
+				current_cursor =
+				ALLEGRO_SYSTEM_MOUSE_CURSOR_DEFAULT;
 			}
-			yy += sizes[i];
-		}
-		else {
-			if (!used &&
-					rel_x >= xx+hpadding &&
-					rel_x <= xx+sizes[i]-hpadding &&
-					rel_y >= yy+vpadding &&
-					rel_y <= yy+height-vpadding &&
-					widget
-			) {
-				static ALLEGRO_SYSTEM_MOUSE_CURSOR cursor = ALLEGRO_SYSTEM_MOUSE_CURSOR_DEFAULT;
-				ALLEGRO_SYSTEM_MOUSE_CURSOR current_cursor = cursor;
-				if (
-					i < widgets.size()-1 &&
-					section_is_resizable[i] &&
-					rel_x >= xx+(sizes[i]-5)
-				) {
-					current_cursor =
-					ALLEGRO_SYSTEM_MOUSE_CURSOR_RESIZE_E;
-				}
-				else {
-					current_cursor =
-					ALLEGRO_SYSTEM_MOUSE_CURSOR_DEFAULT;
-				}
-				if (cursor != current_cursor) {
-					al_set_system_mouse_cursor(tgui::getDisplay(), current_cursor);
-					cursor = current_cursor;
-				}
-				al_set_system_mouse_cursor(tgui::getDisplay(), cursor);
-				if (((TGUI_Extended_Widget *)widget)->getTamperingEnabled() ||
-					(rel_x >= xx+widget->getX() &&
-					rel_x <= xx+widget->getX()+widget->getWidth() &&
-					rel_y >= yy+widget->getY() &&
-					rel_y <= yy+widget->getY()+widget->getHeight())) {
-					widget->mouseMove(
-						rel_x-xx,
-						rel_y-yy,
-						abs_x,
-						abs_y
-					);
-					used = true;
-				}
+			if (cursor != current_cursor) {
+				al_set_system_mouse_cursor(tgui::getDisplay(), current_cursor);
+				cursor = current_cursor;
 			}
-			else if (widget) {
+			if (overSectionWidget(i, rel_x, rel_y)) {
+				int xx, yy;
+				getSectionOffset(i, &xx, &yy);
 				widget->mouseMove(
-					-1, -1,
-					abs_x, abs_y
+					rel_x-xx,
+					rel_y-yy,
+					abs_x,
+					abs_y
 				);
+				used = true;
 			}
-			xx += sizes[i];
+		}
+		else if (widget) {
+			widget->mouseMove(
+				-1, -1,
+				abs_x, abs_y
+			);
 		}
 	}
 }
@@ -822,6 +741,7 @@ void TGUI_Splitter::set_size(int index, int size)
 {
 	int difference = sizes[index] - size;
 	sizes[index] = size;
+	updateOffsets();
 
 	int total = 0;
 	for (unsigned int i = 0; i < sizes.size(); i++) {
@@ -855,8 +775,9 @@ void TGUI_Splitter::set_size(int index, int size)
 			difference += sub;
 		}
 	}
-	
-	layout();
+
+	updateOffsets();
+	invalidateLayout();
 }
 
 void TGUI_Splitter::set_widget(int index, TGUIWidget *widget)
@@ -871,8 +792,7 @@ void TGUI_Splitter::setClearColor(ALLEGRO_COLOR c)
 
 void TGUI_Splitter::layout()
 {
-	int xx = x;
-	int yy = y;
+	updateOffsets();
 
 	for (unsigned int i = 0; i < widgets.size(); i++) {
 		TGUIWidget *widget = widgets[i];
@@ -886,22 +806,6 @@ void TGUI_Splitter::layout()
 				widget->setWidth(sizes[i]-(hpadding*2));
 				widget->setHeight(height-(vpadding*2));
 			}
-
-			TGUI_Splitter *s = dynamic_cast<TGUI_Splitter *>(widget);
-			if (s) {
-				s->layout();
-			}
-			else {
-				dummies[i]->setX(xx);
-				dummies[i]->setY(yy);
-			}
-		}
-
-		if (direction == TGUI_VERTICAL) {
-			yy += sizes[i];
-		}
-		else {
-			xx += sizes[i];
 		}
 	}
 }
@@ -929,7 +833,7 @@ void TGUI_Splitter::setPadding(int hpadding, int vpadding)
 		}
 	}
 
-	layout();
+	invalidateLayout();
 }
 
 std::vector<tgui::TGUIWidget *> &TGUI_Splitter::getWidgets()
@@ -947,7 +851,7 @@ TGUI_Splitter::TGUI_Splitter(
 	int w, int h,
 	TGUI_Direction dir,
 	bool can_resize,
-	std::vector<TGUIWidget *> widgets
+	const std::vector<TGUIWidget *> &widgets
 ) :
 	direction(dir),
 	weighted_resize(false),
@@ -967,15 +871,19 @@ TGUI_Splitter::TGUI_Splitter(
 	const int num_widgets = widgets.size();
 	const int total_size = direction == TGUI_VERTICAL ? height : width;
 
+	sizes.reserve(num_widgets);
+	section_resize_weight.reserve(num_widgets);
+	section_is_resizable.reserve(num_widgets);
+
 	for (int i = 0; i < num_widgets; i++) {
 		sizes.push_back(total_size / num_widgets);
 		section_resize_weight.push_back(1.0f / num_widgets);
 		section_is_resizable.push_back(can_resize);
 
-			TGUI_DummyWidget *dummy = new TGUI_DummyWidget(0, 0);
-			dummies.push_back(dummy);
+		// Children are positioned through getAbsoluteChildPosition
+		// using offsets[]
 		if (widgets[i]) {
-			widgets[i]->setParent(dummy);
+			widgets[i]->setParent(this);
 		}
 	}
 
@@ -988,7 +896,6 @@ TGUI_Splitter::TGUI_Splitter(
 	bool weighted_resize;
 
 	std::vector<tgui::TGUIWidget *> widgets;
-	std::vector<TGUI_DummyWidget *> dummies;
 	std::vector<int> sizes;
 	std::vector<float> section_resize_weight;
 	std::vector<bool> section_is_resizable; // 1 less then widgets.size()
@@ -998,13 +905,6 @@ TGUI_Splitter::TGUI_Splitter(
 	bool drawLines;
 */
 
-TGUI_Splitter::~TGUI_Splitter()
-{
-	for (unsigned int i = 0; i < dummies.size(); i++) {
-		delete dummies[i];
-	}
-}
-
 // --
 
 int TGUI_TextMenuItem::getShortcutKeycode()
@@ -1034,18 +934,14 @@ void TGUI_TextMenuItem::draw(int abs_x, int abs_y)
 	}
 
 	al_clear_to_color(back);
-	al_draw_text(tgui::getFont(), fore, abs_x+HEIGHT, abs_y, 0,
-		name.c_str());
+	tgui::drawText(tgui::getFont(), fore, abs_x+HEIGHT, abs_y, 0, name);
 	if (shortcut_keycode) {
-		const char *str = al_keycode_to_name(shortcut_keycode);
-		if (strlen(str) == 1) {
-			al_draw_textf(tgui::getFont(), fore, abs_x+width-HEIGHT, abs_y, ALLEGRO_ALIGN_RIGHT, "%s",
-				al_keycode_to_name(shortcut_keycode));
-			al_draw_textf(tgui::getFont(), fore, abs_x+width-HEIGHT-al_get_font_line_height(tgui::getFont()), abs_y, ALLEGRO_ALIGN_RIGHT, "Ctrl-");
+		if (shortcut_key.length() == 1) {
+			tgui::drawText(tgui::getFont(), fore, abs_x+width-HEIGHT, abs_y, ALLEGRO_ALIGN_RIGHT, shortcut_key);
+			tgui::drawText(tgui::getFont(), fore, abs_x+width-HEIGHT-tgui::getLineHeight(tgui::getFont()), abs_y, ALLEGRO_ALIGN_RIGHT, shortcut_label);
 		}
 		else {
-			al_draw_textf(tgui::getFont(), fore, abs_x+width-HEIGHT, abs_y, ALLEGRO_ALIGN_RIGHT, "Ctrl-%s",
-				al_keycode_to_name(shortcut_keycode));
+			tgui::drawText(tgui::getFont(), fore, abs_x+width-HEIGHT, abs_y, ALLEGRO_ALIGN_RIGHT, shortcut_label);
 		}
 	}
 	
@@ -1085,12 +981,21 @@ void TGUI_TextMenuItem::mouseMoveAll(tgui::TGUIWidget *leftOut, int abs_x, int a
 	// do nothing except override default behaviour
 }
 
-TGUI_TextMenuItem::TGUI_TextMenuItem(std::string name, int shortcut_keycode) :
+TGUI_TextMenuItem::TGUI_TextMenuItem(const std::string &name, int shortcut_keycode) :
 	name(name),
 	shortcut_keycode(shortcut_keycode),
 	clicked(false),
 	hover(false)
 {
+	setPositionsChildren(false);
+
+	if (shortcut_keycode) {
+		shortcut_key = al_keycode_to_name(shortcut_keycode);
+		shortcut_label = "Ctrl-";
+		if (shortcut_key.length() != 1) {
+			shortcut_label += shortcut_key;
+		}
+	}
 }
 
 // --
@@ -1147,7 +1052,7 @@ void TGUI_CheckMenuItem::setChecked(bool checked)
 	this->checked = checked;
 }
 	
-TGUI_CheckMenuItem::TGUI_CheckMenuItem(std::string name, int shortcut_keycode, bool checked) :
+TGUI_CheckMenuItem::TGUI_CheckMenuItem(const std::string &name, int shortcut_keycode, bool checked) :
 	TGUI_TextMenuItem(name, shortcut_keycode),
 	checked(checked)
 {
@@ -1199,7 +1104,7 @@ void TGUI_RadioMenuItem::setSelected()
 	group->selected = id;
 }
 
-TGUI_RadioMenuItem::TGUI_RadioMenuItem(std::string name, int shortcut_keycode, TGUI_RadioGroup *group, int id) :
+TGUI_RadioMenuItem::TGUI_RadioMenuItem(const std::string &name, int shortcut_keycode, TGUI_RadioGroup *group, int id) :
 	TGUI_TextMenuItem(name, 0),
 	group(group),
 	id(id)
@@ -1218,10 +1123,10 @@ void TGUI_SubMenuItem::close()
 	if (!is_open)
 		return;
 	
-	std::vector<TGUI_SubMenuItem *> subMenus;
-	getVisibleSubMenus(sub_menu, subMenus, 0, 0);
-	for (unsigned int i = 0; i < subMenus.size(); i++) {
-		subMenus[i]->close();
+	tgui::TGUIScratchVector subMenus;
+	getVisibleSubMenus(sub_menu, *subMenus, 0, 0);
+	for (unsigned int i = 0; i < subMenus->size(); i++) {
+		static_cast<TGUI_SubMenuItem *>((*subMenus)[i])->close();
 	}
 	sub_menu->remove();
 	
@@ -1244,7 +1149,7 @@ void TGUI_SubMenuItem::draw(int abs_x, int abs_y)
 		fore = al_map_rgb(0x00, 0x00, 0x00);
 	}
 
-	al_draw_text(tgui::getFont(), fore, abs_x+x+width-al_get_text_width(tgui::getFont(), ">")-5, abs_y+y, 0, ">");
+	tgui::drawText(tgui::getFont(), fore, abs_x+x+width-tgui::getTextWidth(tgui::getFont(), ">")-5, abs_y+y, 0, ">");
 }
 
 void TGUI_SubMenuItem::mouseDown(int rel_x, int rel_y, int abs_x, int abs_y, int mb)
@@ -1264,16 +1169,17 @@ void TGUI_SubMenuItem::mouseMove(int rel_x, int rel_y, int abs_x, int abs_y)
 		close();
 	}
 	else if (!is_open && (rel_x >= 0 && rel_y >= 0)) {
-		sub_menu->setX((parent ? parent->getX() : 0)+x+width);
-		sub_menu->setY((parent ? parent->getY() : 0)+y);
+		int item_x, item_y;
+		tgui::determineAbsolutePosition(this, &item_x, &item_y);
+		sub_menu->setX(item_x+width);
+		sub_menu->setY(item_y);
 		tgui::addWidget(sub_menu);
 		is_open = true;
 
-		std::vector<tgui::TGUIWidget *> neighbors = parentSplitter->getWidgets();
+		std::vector<tgui::TGUIWidget *> &neighbors = parentSplitter->getWidgets();
 		for (unsigned int i = 0; i < neighbors.size(); i++) {
-			TGUI_SubMenuItem *item = dynamic_cast<TGUI_SubMenuItem *>(neighbors[i]);
-			if (item && this != item) {
-				item->close();
+			if (tguiIsKind(neighbors[i], TGUI_KIND_SUB_MENU_ITEM) && this != neighbors[i]) {
+				static_cast<TGUI_SubMenuItem *>(neighbors[i])->close();
 			}
 		}
 	}
@@ -1294,7 +1200,7 @@ void TGUI_SubMenuItem::setSubMenu(TGUI_Splitter *sub)
 	sub_menu = sub;
 }
 
-TGUI_SubMenuItem::TGUI_SubMenuItem(std::string name, TGUI_Splitter *sub_menu) :
+TGUI_SubMenuItem::TGUI_SubMenuItem(const std::string &name, TGUI_Splitter *sub_menu) :
 	TGUI_TextMenuItem(name, 0),
 	is_open(false),
 	sub_menu(sub_menu)
@@ -1307,20 +1213,18 @@ void TGUI_MenuBar::checkKeys(int keycode, TGUI_Splitter *splitter)
 {
 	std::vector<tgui::TGUIWidget *> &w = splitter->getWidgets();
 	for (unsigned int i = 0; i < w.size(); i++) {
-		TGUI_TextMenuItem *item = dynamic_cast<TGUI_TextMenuItem *>(w[i]);
-		if (item) {
+		// submenu items are text menu items too, check them first
+		if (tguiIsKind(w[i], TGUI_KIND_SUB_MENU_ITEM)) {
+			checkKeys(keycode, static_cast<TGUI_SubMenuItem *>(w[i])->getSubMenu());
+		}
+		else if (tguiIsKind(w[i], TGUI_KIND_TEXT_MENU_ITEM)) {
+			TGUI_TextMenuItem *item = static_cast<TGUI_TextMenuItem *>(w[i]);
 			if (keycode == item->getShortcutKeycode()) {
-				itemToReturn = item;
+				itemToReturn = item->getHandle();
 				return;
 			}
 		}
-		else {
-			TGUI_SubMenuItem *sub = dynamic_cast<TGUI_SubMenuItem *>(w[i]);
-			if (sub) {
-				checkKeys(keycode, sub->getSubMenu());
-			}
-		}
-		if (itemToReturn)
+		if (!itemToReturn.isNull())
 			return;
 	}
 }
@@ -1340,8 +1244,8 @@ void TGUI_MenuBar::setSubMenuSplitters(TGUI_Splitter *root)
 {
 	std::vector<tgui::TGUIWidget *> &w = root->getWidgets();
 	for (unsigned int i = 0; i < w.size(); i++) {
-		TGUI_SubMenuItem *item = dynamic_cast<TGUI_SubMenuItem *>(w[i]);
-		if (item) {
+		if (tguiIsKind(w[i], TGUI_KIND_SUB_MENU_ITEM)) {
+			TGUI_SubMenuItem *item = static_cast<TGUI_SubMenuItem *>(w[i]);
 			item->setParentSplitter(root);
 			setSubMenuSplitters(item->getSubMenu());
 		}
@@ -1357,10 +1261,9 @@ void TGUI_MenuBar::draw(int abs_x, int abs_y)
 	int xx = abs_x+PADDING;
 	
 	for (unsigned int i = 0; i < menu_names.size(); i++) {
-		std::string name = menu_names[i];
-		al_draw_text(tgui::getFont(), al_map_rgb(0xff, 0xff, 0xff), xx, abs_y, 0,
-			name.c_str());
-		int len = al_get_text_width(tgui::getFont(), name.c_str());
+		const std::string &name = menu_names[i];
+		tgui::drawText(tgui::getFont(), al_map_rgb(0xff, 0xff, 0xff), xx, abs_y, 0, name);
+		int len = tgui::getTextWidth(tgui::getFont(), name);
 		xx += len + PADDING;
 	}
 }
@@ -1378,13 +1281,13 @@ void TGUI_MenuBar::mouseDown(int rel_x, int rel_y, int abs_x, int abs_y, int mb)
 	int xx = x+PADDING;
 	
 	for (unsigned int i = 0; i < menu_names.size(); i++) {
-		std::string name = menu_names[i];
-		int len = al_get_text_width(tgui::getFont(), name.c_str());
+		const std::string &name = menu_names[i];
+		int len = tgui::getTextWidth(tgui::getFont(), name);
 		if (rel_x >= xx && rel_x <= xx+len) {
 			open_menu = menus[i];
 			open_menu->setX(xx);
 			open_menu->setY(y+height);
-			open_menu->layout();
+			open_menu->invalidateLayout();
 			tgui::setNewWidgetParent(NULL);
 			tgui::addWidget(open_menu);
 			break;
@@ -1396,10 +1299,10 @@ void TGUI_MenuBar::mouseDown(int rel_x, int rel_y, int abs_x, int abs_y, int mb)
 void TGUI_MenuBar::close()
 {
 	// close submenus first
-	std::vector<TGUI_SubMenuItem *> subMenus;
-	getVisibleSubMenus(open_menu, subMenus, 0, 0);
-	for (unsigned int i = 0; i < subMenus.size(); i++) {
-		TGUI_SubMenuItem *sub = subMenus[i];
+	tgui::TGUIScratchVector subMenus;
+	getVisibleSubMenus(open_menu, *subMenus, 0, 0);
+	for (unsigned int i = 0; i < subMenus->size(); i++) {
+		TGUI_SubMenuItem *sub = static_cast<TGUI_SubMenuItem *>((*subMenus)[i]);
 		sub->close();
 	}
 	close_menu = false;
@@ -1409,9 +1312,9 @@ void TGUI_MenuBar::close()
 
 tgui::TGUIWidget *TGUI_MenuBar::update()
 {
-	if (itemToReturn) {
-		tgui::TGUIWidget *tmp = itemToReturn;
-		itemToReturn = NULL;
+	if (!itemToReturn.isNull()) {
+		tgui::TGUIWidget *tmp = tgui::getWidget(itemToReturn);
+		itemToReturn = tgui::TGUIHandle();
 		return tmp;
 	}
 
@@ -1420,25 +1323,28 @@ tgui::TGUIWidget *TGUI_MenuBar::update()
 
 TGUI_MenuBar::TGUI_MenuBar(
 	int x, int y, int w, int h,
-	std::vector<std::string> menu_names,
-	std::vector<TGUI_Splitter *> menus
+	const std::vector<std::string> &menu_names,
+	const std::vector<TGUI_Splitter *> &menus
 ) :
 	menu_names(menu_names),
 	menus(menus),
 	open_menu(NULL),
 	close_menu(false),
-	itemToReturn(NULL)
+	itemToReturn()
 {
+	setPositionsChildren(false);
+
 	this->x = x;
 	this->y = y;
 	this->width = w;
 	this->height = h;
 
 	for (unsigned int i = 0; i < menus.size(); i++) {
-		std::vector<tgui::TGUIWidget *> w = menus[i]->getWidgets();
+		std::vector<tgui::TGUIWidget *> &w = menus[i]->getWidgets();
 		for (unsigned int j = 0; j < w.size(); j++) {
-			TGUI_TextMenuItem *item = dynamic_cast<TGUI_TextMenuItem *>(w[j]);
-			item->setMenuBar(this);
+			if (tguiIsKind(w[j], TGUI_KIND_TEXT_MENU_ITEM)) {
+				static_cast<TGUI_TextMenuItem *>(w[j])->setMenuBar(this);
+			}
 		}
 		setSubMenuSplitters(menus[i]);
 	}
@@ -1677,6 +1583,8 @@ TGUI_ScrollPane::TGUI_ScrollPane(tgui::TGUIWidget *child) :
 	oy(0),
 	down(DOWN_NONE)
 {
+	setPositionsChildren(false);
+
 	this->child = child;
 	child->setParent(this);
 }
@@ -1795,6 +1703,8 @@ TGUI_Slider::TGUI_Slider(int x, int y, int size, TGUI_Direction direction) :
 	size(size),
 	direction(direction)
 {
+	setPositionsChildren(false);
+
 	this->x = x;
 	this->y = y;
 
@@ -1826,13 +1736,13 @@ void TGUI_Button::draw(int abs_x, int abs_y)
 	al_draw_line(x+0.5, y+height-0.5, x+width+0.5, y+height-0.5, back_darker, 1); // little longer to cover pixel
 	al_draw_line(x+width-0.5, y+0.5, x+width-0.5, y+height-0.5, back_darker, 1);
 
-	al_draw_text(tgui::getFont(), al_map_rgb(0x00, 0x00, 0x00),
-		x+(int)width/2-al_get_text_width(tgui::getFont(), text.c_str())/2,
-		y+(int)height/2-al_get_font_line_height(tgui::getFont())/2,
-		0, text.c_str());
+	tgui::drawText(tgui::getFont(), al_map_rgb(0x00, 0x00, 0x00),
+		x+(int)width/2-tgui::getTextWidth(tgui::getFont(), text)/2,
+		y+(int)height/2-tgui::getLineHeight(tgui::getFont())/2,
+		0, text);
 }
 
-TGUI_Button::TGUI_Button(std::string text, int x, int y, int w, int h) :
+TGUI_Button::TGUI_Button(const std::string &text, int x, int y, int w, int h) :
 	TGUI_Icon(NULL, 0, 0, 0),
 	text(text)
 {
@@ -1842,7 +1752,9 @@ TGUI_Button::TGUI_Button(std::string text, int x, int y, int w, int h) :
 	height = h;
 }
 
-static void getVisibleSubMenus(TGUI_Splitter *root, std::vector<TGUI_SubMenuItem *> &subMenus, int depth, int maxDepth)
+// subMenus gets TGUI_SubMenuItems, as widgets so a scratch vector can be
+// used
+static void getVisibleSubMenus(TGUI_Splitter *root, std::vector<tgui::TGUIWidget *> &subMenus, int depth, int maxDepth)
 {
 	if (depth > maxDepth)
 		return;
@@ -1850,8 +1762,8 @@ static void getVisibleSubMenus(TGUI_Splitter *root, std::vector<TGUI_SubMenuItem
 	std::vector<tgui::TGUIWidget *> &widgets = root->getWidgets();
 
 	for (unsigned int i = 0; i < widgets.size(); i++) {
-		TGUI_SubMenuItem *sub = dynamic_cast<TGUI_SubMenuItem *>(widgets[i]);
-		if (sub) {
+		if (tguiIsKind(widgets[i], TGUI_KIND_SUB_MENU_ITEM)) {
+			TGUI_SubMenuItem *sub = static_cast<TGUI_SubMenuItem *>(widgets[i]);
 			subMenus.push_back(sub);
 			if (sub->isOpen()) {
 				getVisibleSubMenus(sub->getSubMenu(), subMenus, depth+1, maxDepth);
@@ -1871,23 +1783,26 @@ void TGUI_TextField::draw(int abs_x, int abs_y)
 {
 	setDefaultColors();
 
-	this->height = al_get_font_line_height(tgui::getFont()) + PADDING*2;
+	int h = tgui::getLineHeight(tgui::getFont()) + PADDING*2;
+	if (h != this->height) {
+		this->height = h;
+		tgui::invalidateBounds();
+	}
+
+	checkMetrics();
 
 	ALLEGRO_COLOR bgcolor = al_map_rgb(0xff, 0xff, 0xff);
 
 	al_draw_filled_rectangle(abs_x, abs_y, abs_x+width, abs_y+height, bgcolor);
 	al_draw_rectangle(abs_x+0.5, abs_y+0.5, abs_x+width-0.5, abs_y+height-0.5, al_map_rgb(0x00, 0x00, 0x00), 1);
 	if (this == tgui::getFocussedWidget()) {
-		int len = cursorPos - offset;
-		std::string before = str.substr(offset, len);
-		int xx = abs_x+1+al_get_text_width(tgui::getFont(), before.c_str());
+		int xx = abs_x+1+prefix[cursorPos]-prefix[offset];
 		int xx2;
-		if (cursorPos >= (int)str.length()) {
+		if (cursorPos >= (int)starts.size()-1) {
 			xx2 = xx + 5;
 		}
 		else {
-			std::string at = str.substr(offset+len, 1);
-			xx2 = xx+al_get_text_width(tgui::getFont(), at.c_str());
+			xx2 = abs_x+1+prefix[cursorPos+1]-prefix[offset];
 		}
 		al_draw_filled_rectangle(xx, abs_y+1, xx2, abs_y+height-2,
 			al_map_rgb(0, 255, 255));
@@ -1895,17 +1810,77 @@ void TGUI_TextField::draw(int abs_x, int abs_y)
 	int _x, _y, _w, _h;
 	al_get_clipping_rectangle(&_x, &_y, &_w, &_h);
 	tgui::setClip(abs_x+3, abs_y, width-4, height);
-	al_draw_text(tgui::getFont(), al_map_rgb(0x00, 0x00, 0x00), abs_x+3, abs_y+PADDING, 0, str.substr(offset).c_str());
+	// glyph by glyph at the cached positions, only those that show
+	ALLEGRO_COLOR color = al_map_rgb(0x00, 0x00, 0x00);
+	for (int i = offset; i < (int)starts.size()-1; i++) {
+		int xx = prefix[i]-prefix[offset];
+		if (xx >= width)
+			break;
+		int pos = starts[i];
+		int cp = buffer.nextCodePoint(&pos);
+		al_draw_glyph(tgui::getFont(), color, abs_x+3+xx, abs_y+PADDING, cp);
+	}
 	al_set_clipping_rectangle(_x, _y, _w, _h);
 }
 
+void TGUI_TextField::updateMetrics(int from)
+{
+	const ALLEGRO_FONT *font = tgui::getFont();
+	metricsFont = font;
+
+	size_t startsCapacity = starts.capacity();
+	size_t prefixCapacity = prefix.capacity();
+	starts.resize(from+1);
+	prefix.resize(from+1);
+
+	int pos = starts[from];
+	int xx = prefix[from];
+	int cp;
+	while ((cp = buffer.nextCodePoint(&pos)) >= 0) {
+		if (font) {
+			xx += tgui::getCodePointAdvance(font, cp);
+		}
+		starts.push_back(pos);
+		prefix.push_back(xx);
+	}
+
+	tgui::countGrowth(starts, startsCapacity);
+	tgui::countGrowth(prefix, prefixCapacity);
+}
+
+// Widths are per font, so start over after setFont
+void TGUI_TextField::checkMetrics()
+{
+	if (tgui::getFont() != metricsFont) {
+		updateMetrics(0);
+		findOffset();
+	}
+}
+
+// Nearest code point boundary to x pixels from the left of the widget
+int TGUI_TextField::findCursor(int x)
+{
+	int target = prefix[offset] + x - 1;
+	int n = starts.size()-1;
+	int i = std::upper_bound(prefix.begin()+offset, prefix.end(), target) - prefix.begin() - 1;
+	if (i < offset)
+		return offset;
+	if (i < n && target-prefix[i] > prefix[i+1]-target)
+		i++;
+	return i;
+}
+
 void TGUI_TextField::findOffset()
 {
-	int len = cursorPos - offset;
-	std::string tmp = str.substr(offset, len);
-	if (al_get_text_width(tgui::getFont(), tmp.c_str()) >= width-15) {
-		if (offset < (int)str.length()-1)
-			offset++;
+	if (cursorPos < offset) {
+		offset = cursorPos;
+		return;
+	}
+
+	// Smallest offset that leaves the cursor inside
+	int visible = width-15;
+	if (prefix[cursorPos]-prefix[offset] >= visible) {
+		offset = std::upper_bound(prefix.begin()+offset, prefix.begin()+cursorPos, prefix[cursorPos]-visible) - prefix.begin();
 	}
 }
 
@@ -1916,90 +1891,168 @@ bool TGUI_TextField::keyChar(int keycode, int unichar)
 	if (this != tgui::getFocussedWidget())
 		return false;
 
+	checkMetrics();
+
+	int length = starts.size()-1;
+
 	if (keycode == ALLEGRO_KEY_BACKSPACE) {
 		if (cursorPos > 0) {
 			cursorPos--;
-			str.erase(str.begin() + cursorPos);
-			if (cursorPos < offset)
-				offset--;
+			buffer.erase(starts[cursorPos], starts[cursorPos+1]-starts[cursorPos]);
+			updateMetrics(cursorPos);
+			findOffset();
 		}
+		return used;
 	}
 	else if (keycode == ALLEGRO_KEY_DELETE) {
-		if (cursorPos < (int)str.length()) {
-			str.erase(str.begin() + cursorPos);
+		if (cursorPos < length) {
+			buffer.erase(starts[cursorPos], starts[cursorPos+1]-starts[cursorPos]);
+			updateMetrics(cursorPos);
 		}
+		return used;
 	}
 	else if (keycode == ALLEGRO_KEY_LEFT) {
 		used = true;
 		if (cursorPos > 0) {
 			cursorPos--;
-			if (cursorPos < offset)
-				offset--;
+			findOffset();
 		}
 	}
 	else if (keycode == ALLEGRO_KEY_RIGHT) {
 		used = true;
-		if (cursorPos < (int)str.length()) {
+		if (cursorPos < length) {
 			cursorPos++;
 			findOffset();
 		}
 	}
 
-	if (unichar <= 0) {
+	// control characters (Enter, Tab, Esc...) aren't text
+	if (unichar < 32 || unichar == 127) {
 		return used;
 	}
 
-	std::string backup = str;
-	if (cursorPos >= (int)str.length()) {
-		str.push_back(unichar);
-	}
-	else {
-		str.insert(str.begin() + cursorPos, unichar);
-	}
-	if (validate && validate(str)) {
-		cursorPos++;
-		findOffset();
+	insertText(tgui::utf8Encode(unichar));
+
+	return false;
+}
+
+bool TGUI_TextField::acceptEdit(int start, int end)
+{
+	if (editValidator)
+		return editValidator(buffer, start, end);
+	if (validate || validateCopy) {
+		buffer.copy(0, buffer.length(), validateText);
+		if (validate)
+			return validate(validateText);
+		return validateCopy(validateText);
 	}
-	else {
-		str = backup;
+	return true;
+}
+
+bool TGUI_TextField::replaceText(int start, int end, const std::string &s)
+{
+	checkMetrics();
+
+	int length = starts.size()-1;
+	start = MAX(0, MIN(start, length));
+	end = MAX(start, MIN(end, length));
+
+	int byte_start = starts[start];
+	int byte_end = byte_start + s.length();
+	// only the replaced part is kept for undoing a rejected edit
+	std::string removed = buffer.substr(byte_start, starts[end]-byte_start);
+
+	buffer.erase(byte_start, removed.length());
+	buffer.insert(byte_start, s.c_str(), s.length());
+
+	if (!acceptEdit(byte_start, byte_end)) {
+		buffer.erase(byte_start, s.length());
+		buffer.insert(byte_start, removed.c_str(), removed.length());
+		return false;
 	}
 
-	return false;
+	updateMetrics(start);
+	cursorPos = std::lower_bound(starts.begin()+start, starts.end(), byte_end) - starts.begin();
+	findOffset();
+
+	return true;
 }
 
-void TGUI_TextField::setValidator(bool (*validate)(const std::string str))
+bool TGUI_TextField::insertText(const std::string &s)
+{
+	return replaceText(cursorPos, cursorPos, s);
+}
+
+void TGUI_TextField::mouseDown(int rel_x, int rel_y, int abs_x, int abs_y, int mb)
+{
+	if (rel_x < 0)
+		return;
+
+	checkMetrics();
+
+	cursorPos = findCursor(rel_x);
+	findOffset();
+}
+
+void TGUI_TextField::setValidator(bool (*validate)(const std::string &str))
 {
 	this->validate = validate;
+	validateCopy = NULL;
+}
+
+void TGUI_TextField::setValidator(bool (*validate)(const std::string str))
+{
+	this->validate = NULL;
+	validateCopy = validate;
+}
+
+void TGUI_TextField::setEditValidator(TGUI_TextValidator validator)
+{
+	editValidator = validator;
 }
 
 bool TGUI_TextField::isValid()
 {
-	return validate(str);
+	// the whole text as one edit
+	return acceptEdit(0, buffer.length());
 }
 
 std::string TGUI_TextField::getText()
 {
-	return str;
+	return buffer.str();
+}
+
+void TGUI_TextField::getText(std::string &text)
+{
+	buffer.copy(0, buffer.length(), text);
 }
 
-void TGUI_TextField::setText(std::string s)
+void TGUI_TextField::setText(const std::string &s)
 {
-	str = s;
-	cursorPos = str.length();
+	buffer.assign(s);
+	updateMetrics(0);
+	cursorPos = starts.size()-1;
 	offset = 0;
 	findOffset();
 }
 
-TGUI_TextField::TGUI_TextField(std::string startStr, int x, int y, int width) :
-	str(startStr),
-	cursorPos(startStr.length()),
+TGUI_TextField::TGUI_TextField(const std::string &startStr, int x, int y, int width) :
 	offset(0),
-	validate(NULL)
+	metricsFont(NULL),
+	validate(NULL),
+	validateCopy(NULL),
+	editValidator(NULL)
 {
+	setPositionsChildren(false);
+
+	buffer.assign(startStr);
+
 	this->x = x;
 	this->y = y;
 	this->width = width;
 
+	updateMetrics(0);
+	cursorPos = starts.size()-1;
 	findOffset();
 }
 
@@ -2009,16 +2062,687 @@ TGUI_TextField::~TGUI_TextField()
 
 // --
 
-int TGUI_Frame::barHeight()
+bool TGUI_TextArea::acceptsFocus()
 {
-	return al_get_font_line_height(tgui::getFont()) + TITLE_PADDING*2;
+	return true;
 }
 
-bool TGUI_Frame::getAbsoluteChildPosition(tgui::TGUIWidget *widget, int *x, int *y)
+bool TGUI_TextArea::rowBefore(int row, const Line &line)
 {
-	if (child == widget) {
-		*x = this->x + widget->getX();
-		*y = this->y + widget->getY();
+	return row < line.row;
+}
+
+bool TGUI_TextArea::startBefore(int pos, const Line &line)
+{
+	return pos < line.start;
+}
+
+void TGUI_TextArea::draw(int abs_x, int abs_y)
+{
+	checkLayout();
+
+	const ALLEGRO_FONT *font = tgui::getFont();
+
+	al_draw_filled_rectangle(abs_x, abs_y, abs_x+width, abs_y+height, al_map_rgb(0xff, 0xff, 0xff));
+
+	if (!font)
+		return;
+
+	// the rows inside the clipping rectangle
+	float x1, y1, x2, y2;
+	if (!tgui::getLocalClip(&x1, &y1, &x2, &y2)) {
+		y1 = abs_y;
+		y2 = abs_y + height;
+		x2 = abs_x + width;
+	}
+
+	int lh = tgui::getLineHeight(font);
+	int first_row = MAX(0, ((int)y1 - abs_y - PADDING) / lh);
+	int last_row = ((int)y2 - abs_y - PADDING) / lh;
+	visibleRows = MAX(1, (int)(MIN(y2, abs_y + height) - MAX(y1, abs_y)) / lh);
+
+	int cursor_line;
+	int cursor_row = cursorRow(&cursor_line);
+	bool focussed = this == tgui::getFocussedWidget();
+
+	for (int i = findRowLine(first_row); i < (int)lines.size() && lines[i].row <= last_row; i++) {
+		const Line &l = lines[i];
+		int rows = numRows(i);
+		for (int r = 0; r < rows; r++) {
+			int row = l.row + r;
+			if (row < first_row)
+				continue;
+			if (row > last_row)
+				break;
+			int xx = abs_x + PADDING;
+			int yy = abs_y + PADDING + row*lh;
+			int rs = rowStart(i, r);
+			int re = rowEnd(i, r);
+
+			if (focussed && i == cursor_line && r == cursor_row) {
+				int cx = xx + advanceRange(font, rs, cursor);
+				al_draw_filled_rectangle(cx, yy, cx+2, yy+lh, al_map_rgb(0, 255, 255));
+			}
+
+			// straight from the text's pieces, so only the row is
+			// read, up to the clip's right edge. Gaps between tokens
+			// in the text colour.
+			float tx = xx;
+			int pos = rs;
+			for (size_t t = 0; t < l.tokens.size() && tx < x2; t++) {
+				const TGUI_TextToken &tok = l.tokens[t];
+				int ts = MAX(pos, l.start+tok.start);
+				int te = MIN(re, l.start+tok.start+tok.length);
+				if (te <= ts)
+					continue;
+				tx = drawRange(font, textColor, tx, yy, pos, ts, x2);
+				tx = drawRange(font, tok.color, tx, yy, ts, te, x2);
+				pos = te;
+			}
+			drawRange(font, textColor, tx, yy, pos, re, x2);
+		}
+	}
+}
+
+// Byte after the last one of a line, not counting its newline
+int TGUI_TextArea::lineEnd(int line)
+{
+	if (line+1 < (int)lines.size())
+		return lines[line+1].start - 1;
+	return text.length();
+}
+
+int TGUI_TextArea::numRows(int line)
+{
+	return lines[line].breaks.size() + 1;
+}
+
+int TGUI_TextArea::rowStart(int line, int row)
+{
+	if (row == 0)
+		return lines[line].start;
+	return lines[line].start + lines[line].breaks[row-1];
+}
+
+int TGUI_TextArea::rowEnd(int line, int row)
+{
+	if (row+1 < numRows(line))
+		return lines[line].start + lines[line].breaks[row];
+	return lineEnd(line);
+}
+
+// Line holding byte pos
+int TGUI_TextArea::findLine(int pos)
+{
+	int i = std::upper_bound(lines.begin(), lines.end(), pos, startBefore) - lines.begin() - 1;
+	return MAX(0, i);
+}
+
+// Line holding screen row row
+int TGUI_TextArea::findRowLine(int row)
+{
+	int i = std::upper_bound(lines.begin(), lines.end(), row, rowBefore) - lines.begin() - 1;
+	return MAX(0, i);
+}
+
+// Row of the cursor within its line
+int TGUI_TextArea::cursorRow(int *line)
+{
+	*line = findLine(cursor);
+	const std::vector<int> &breaks = lines[*line].breaks;
+	return std::upper_bound(breaks.begin(), breaks.end(), cursor-lines[*line].start) - breaks.begin();
+}
+
+// Nearest code point boundary to x pixels into a row
+int TGUI_TextArea::byteAtX(int line, int row, int x)
+{
+	const ALLEGRO_FONT *font = tgui::getFont();
+	int start = rowStart(line, row);
+	int end = rowEnd(line, row);
+	std::string s = text.substr(start, end-start);
+
+	int xx = 0;
+	size_t pos = 0;
+	while (pos < s.length()) {
+		size_t prev = pos;
+		int cp = tgui::utf8Next(s.c_str(), &pos);
+		int adv = font ? tgui::getCodePointAdvance(font, cp) : 0;
+		if (x < xx + adv/2)
+			return start + prev;
+		xx += adv;
+	}
+
+	return end;
+}
+
+int TGUI_TextArea::cursorXInRow()
+{
+	const ALLEGRO_FONT *font = tgui::getFont();
+	if (!font)
+		return 0;
+
+	int line;
+	int start = rowStart(line, cursorRow(&line));
+	return advanceRange(font, start, cursor);
+}
+
+// getTextAdvance of bytes start to end, read from the text's pieces
+int TGUI_TextArea::advanceRange(const ALLEGRO_FONT *font, int start, int end)
+{
+	int w = 0;
+	while (start < end) {
+		int len;
+		const char *s = text.chunk(start, &len);
+		if (len <= 0)
+			break;
+		len = MIN(len, end-start);
+		w += tgui::getTextAdvance(font, s, len);
+		start += len;
+	}
+	return w;
+}
+
+// drawClippedText of bytes start to end, read from the text's pieces,
+// stopping once past right. Returns the x after.
+float TGUI_TextArea::drawRange(const ALLEGRO_FONT *font, ALLEGRO_COLOR color, float x, float y, int start, int end, float right)
+{
+	while (start < end && x < right) {
+		int len;
+		const char *s = text.chunk(start, &len);
+		if (len <= 0)
+			break;
+		len = MIN(len, end-start);
+		x = tgui::drawClippedText(font, color, x, y, s, len);
+		start += len;
+	}
+	return x;
+}
+
+// Makes lines first to last (which ended at end, in the text before the
+// edit moved it) from the text again
+void TGUI_TextArea::splitLines(int first, int last, int end)
+{
+	int start = lines[first].start;
+	bool tail = last == (int)lines.size()-1;
+	std::string s = text.substr(start, end-start);
+
+	Line l;
+	l.width = 0;
+	l.row = 0;
+	l.lexState = 0;
+	l.start = start;
+
+	std::vector<Line> made;
+	made.push_back(l);
+	for (size_t i = 0; i < s.length(); i++) {
+		// the newline ending the last line here starts the next old line
+		if (s[i] == '\n' && (tail || i+1 < s.length())) {
+			l.start = start + i + 1;
+			made.push_back(l);
+		}
+	}
+
+	int old_count = last - first + 1;
+	int n = MIN(old_count, (int)made.size());
+	for (int i = 0; i < n; i++) {
+		lines[first+i] = made[i];
+	}
+	if ((int)made.size() > old_count)
+		lines.insert(lines.begin()+first+n, made.begin()+n, made.end());
+	else
+		lines.erase(lines.begin()+first+n, lines.begin()+last+1);
+}
+
+// Measures a line and finds where it wraps
+void TGUI_TextArea::layoutLine(int line)
+{
+	Line &l = lines[line];
+	l.breaks.clear();
+	l.width = 0;
+
+	const ALLEGRO_FONT *font = tgui::getFont();
+	if (!font)
+		return;
+
+	int limit = width - PADDING*2;
+
+	// the advances draw() steps by, and no whole lines in the shared
+	// width cache
+	if (!wrap || limit <= 0) {
+		l.width = advanceRange(font, l.start, lineEnd(line));
+		return;
+	}
+
+	std::string s = text.substr(l.start, lineEnd(line)-l.start);
+
+	// at the last space in the row if there is one
+	int row_start = 0;
+	int xx = 0;
+	int space = -1;
+	int space_x = 0;
+	size_t pos = 0;
+	while (pos < s.length()) {
+		int prev = pos;
+		int cp = tgui::utf8Next(s.c_str(), &pos);
+		int adv = tgui::getCodePointAdvance(font, cp);
+		if (xx + adv > limit && prev > row_start) {
+			if (space > row_start) {
+				row_start = space;
+				xx -= space_x;
+			}
+			else {
+				row_start = prev;
+				xx = 0;
+			}
+			l.breaks.push_back(row_start);
+			space = -1;
+		}
+		xx += adv;
+		l.width = MAX(l.width, xx);
+		if (cp == ' ') {
+			space = pos;
+			space_x = xx;
+		}
+	}
+}
+
+void TGUI_TextArea::layoutAll()
+{
+	layoutFont = tgui::getFont();
+	layoutDirty = false;
+	maxLineWidth = 0;
+	for (int i = 0; i < (int)lines.size(); i++) {
+		layoutLine(i);
+		maxLineWidth = MAX(maxLineWidth, lines[i].width);
+	}
+	updateRows(0);
+	updateSize();
+}
+
+void TGUI_TextArea::checkLayout()
+{
+	if (layoutDirty || tgui::getFont() != layoutFont)
+		layoutAll();
+}
+
+void TGUI_TextArea::updateRows(int from)
+{
+	int row = from > 0 ? lines[from-1].row + numRows(from-1) : 0;
+	for (int i = from; i < (int)lines.size(); i++) {
+		lines[i].row = row;
+		row += numRows(i);
+	}
+}
+
+// Lexes lines from first on. After last (the edited lines, whose old
+// states are gone) it stops at the first line ending in the state it
+// ended in before.
+void TGUI_TextArea::lexFrom(int first, int last)
+{
+	if (!lexer)
+		return;
+
+	for (int i = first; i < (int)lines.size(); i++) {
+		Line &l = lines[i];
+		int state = i > 0 ? lines[i-1].lexState : 0;
+		std::string s = text.substr(l.start, lineEnd(i)-l.start);
+		l.tokens.clear();
+		int end_state = lexer->lexLine(s.c_str(), s.length(), state, l.tokens);
+		bool same = end_state == l.lexState;
+		l.lexState = end_state;
+		if (i > last && same)
+			break;
+	}
+}
+
+void TGUI_TextArea::updateSize()
+{
+	const ALLEGRO_FONT *font = tgui::getFont();
+	if (!font)
+		return;
+
+	int rows = lines.back().row + numRows(lines.size()-1);
+	int w = wrap ? width : MAX(minWidth, maxLineWidth + PADDING*2 + 2);
+	int h = MAX(minHeight, rows * tgui::getLineHeight(font) + PADDING*2);
+
+	if (w != width || h != height) {
+		width = w;
+		height = h;
+		tgui::invalidateBounds();
+	}
+}
+
+// s as the text area stores it: tabs to spaces, no other control
+// characters but '\n'
+static void cleanTextAreaText(const std::string &s, std::string &out)
+{
+	out.clear();
+	out.reserve(s.length());
+	for (size_t i = 0; i < s.length(); i++) {
+		unsigned char c = s[i];
+		if (c == '\t')
+			out.append(TGUI_TextArea::TAB_SPACES, ' ');
+		else if ((c >= 32 && c != 127) || c == '\n')
+			out += c;
+	}
+}
+
+void TGUI_TextArea::replaceText(int start, int end, const std::string &text_in)
+{
+	std::string s;
+	cleanTextAreaText(text_in, s);
+
+	int length = text.length();
+	start = MAX(0, MIN(start, length));
+	end = MAX(start, MIN(end, length));
+
+	int first = findLine(start);
+	int last = findLine(end);
+	int old_end = last+1 < (int)lines.size() ? lines[last+1].start : length;
+	int old_count = lines.size();
+
+	// the widest line going means looking at all of them again
+	bool rescan = false;
+	for (int i = first; i <= last; i++) {
+		if (lines[i].width >= maxLineWidth)
+			rescan = true;
+	}
+
+	text.erase(start, end-start);
+	text.insert(start, s.c_str(), s.length());
+
+	int delta = (int)s.length() - (end-start);
+	for (int i = last+1; i < (int)lines.size(); i++) {
+		lines[i].start += delta;
+	}
+
+	splitLines(first, last, old_end+delta);
+	last += (int)lines.size() - old_count;
+
+	if (tgui::getFont() != layoutFont) {
+		layoutAll();
+	}
+	else {
+		for (int i = first; i <= last; i++) {
+			layoutLine(i);
+			maxLineWidth = MAX(maxLineWidth, lines[i].width);
+		}
+		if (rescan) {
+			maxLineWidth = 0;
+			for (int i = 0; i < (int)lines.size(); i++) {
+				maxLineWidth = MAX(maxLineWidth, lines[i].width);
+			}
+		}
+		updateRows(first);
+		updateSize();
+	}
+
+	lexFrom(first, last);
+
+	cursor = start + s.length();
+	cursorX = -1;
+}
+
+void TGUI_TextArea::insertText(const std::string &s)
+{
+	replaceText(cursor, cursor, s);
+}
+
+// Moves the cursor up (negative) or down a number of rows, staying near
+// the x it started at
+void TGUI_TextArea::moveVertically(int rows)
+{
+	if (cursorX < 0)
+		cursorX = cursorXInRow();
+
+	int line;
+	int row = lines[findLine(cursor)].row + cursorRow(&line) + rows;
+	int num_rows = lines.back().row + numRows(lines.size()-1);
+	row = MAX(0, MIN(row, num_rows-1));
+
+	line = findRowLine(row);
+	cursor = byteAtX(line, row-lines[line].row, cursorX);
+}
+
+bool TGUI_TextArea::keyChar(int keycode, int unichar)
+{
+	if (this != tgui::getFocussedWidget())
+		return false;
+
+	checkLayout();
+
+	int line;
+	int row = cursorRow(&line);
+	// rows shown at the last draw (a scroll pane's worth), or all of
+	// them before that
+	int page = 1;
+	if (visibleRows > 0)
+		page = visibleRows;
+	else if (tgui::getFont())
+		page = MAX(1, (int)(height - PADDING*2) / tgui::getLineHeight(tgui::getFont()));
+
+	switch (keycode) {
+		case ALLEGRO_KEY_BACKSPACE:
+			if (cursor > 0) {
+				// back over UTF-8 continuation bytes
+				std::string s = text.substr(MAX(0, cursor-4), MIN(cursor, 4));
+				int n = s.length() - 1;
+				while (n > 0 && (s[n] & 0xc0) == 0x80)
+					n--;
+				replaceText(cursor-(s.length()-n), cursor, "");
+			}
+			return true;
+		case ALLEGRO_KEY_DELETE:
+			if (cursor < text.length()) {
+				std::string s = text.substr(cursor, 4);
+				size_t n = 0;
+				tgui::utf8Next(s.c_str(), &n);
+				replaceText(cursor, cursor+n, "");
+			}
+			return true;
+		case ALLEGRO_KEY_ENTER:
+		case ALLEGRO_KEY_PAD_ENTER:
+			insertText("\n");
+			return true;
+		case ALLEGRO_KEY_LEFT:
+			if (cursor > 0) {
+				std::string s = text.substr(MAX(0, cursor-4), MIN(cursor, 4));
+				int n = s.length() - 1;
+				while (n > 0 && (s[n] & 0xc0) == 0x80)
+					n--;
+				cursor -= s.length() - n;
+			}
+			cursorX = -1;
+			return true;
+		case ALLEGRO_KEY_RIGHT:
+			if (cursor < text.length()) {
+				std::string s = text.substr(cursor, 4);
+				size_t n = 0;
+				tgui::utf8Next(s.c_str(), &n);
+				cursor += n;
+			}
+			cursorX = -1;
+			return true;
+		case ALLEGRO_KEY_UP:
+			moveVertically(-1);
+			return true;
+		case ALLEGRO_KEY_DOWN:
+			moveVertically(1);
+			return true;
+		case ALLEGRO_KEY_PGUP:
+			moveVertically(-page);
+			return true;
+		case ALLEGRO_KEY_PGDN:
+			moveVertically(page);
+			return true;
+		case ALLEGRO_KEY_HOME:
+			cursor = rowStart(line, row);
+			cursorX = -1;
+			return true;
+		case ALLEGRO_KEY_END:
+			cursor = rowEnd(line, row);
+			cursorX = -1;
+			return true;
+	}
+
+	if ((unichar < 32 && unichar != '\t') || unichar == 127) {
+		return false;
+	}
+
+	// a tab goes in as spaces
+	insertText(tgui::utf8Encode(unichar));
+
+	return true;
+}
+
+void TGUI_TextArea::mouseDown(int rel_x, int rel_y, int abs_x, int abs_y, int mb)
+{
+	if (rel_x < 0 || !tgui::getFont())
+		return;
+
+	// a TGUI_ScrollPane holding this takes the click but not the focus
+	tgui::setFocus(this);
+
+	checkLayout();
+
+	int num_rows = lines.back().row + numRows(lines.size()-1);
+	int row = (rel_y - PADDING) / tgui::getLineHeight(tgui::getFont());
+	row = MAX(0, MIN(row, num_rows-1));
+
+	int line = findRowLine(row);
+	cursor = byteAtX(line, row-lines[line].row, rel_x-PADDING);
+	cursorX = -1;
+}
+
+tgui::TGUIWidget *TGUI_TextArea::update()
+{
+	checkLayout();
+	return TGUI_Extended_Widget::update();
+}
+
+void TGUI_TextArea::setWidth(int width)
+{
+	TGUI_Extended_Widget::setWidth(width);
+	minWidth = width;
+	// measuring text touches the shared metrics cache, leave it to the
+	// gui thread
+	if (wrap)
+		layoutDirty = true;
+}
+
+void TGUI_TextArea::setHeight(int height)
+{
+	TGUI_Extended_Widget::setHeight(height);
+	minHeight = height;
+}
+
+std::string TGUI_TextArea::getText()
+{
+	return text.str();
+}
+
+void TGUI_TextArea::getText(std::string &s)
+{
+	text.copy(0, text.length(), s);
+}
+
+void TGUI_TextArea::setText(const std::string &text_in)
+{
+	std::string s;
+	cleanTextAreaText(text_in, s);
+	text.assign(s);
+
+	lines.resize(1);
+	lines[0].start = 0;
+	splitLines(0, 0, text.length());
+	layoutAll();
+	lexFrom(0, lines.size()-1);
+
+	cursor = 0;
+	cursorX = -1;
+}
+
+int TGUI_TextArea::getNumLines()
+{
+	return lines.size();
+}
+
+std::string TGUI_TextArea::getLine(int line)
+{
+	return text.substr(lines[line].start, lineEnd(line)-lines[line].start);
+}
+
+int TGUI_TextArea::getCursor()
+{
+	return cursor;
+}
+
+void TGUI_TextArea::setCursor(int pos)
+{
+	cursor = MAX(0, MIN(pos, text.length()));
+	cursorX = -1;
+}
+
+void TGUI_TextArea::setWrap(bool wrap)
+{
+	this->wrap = wrap;
+	layoutAll();
+}
+
+void TGUI_TextArea::setLexer(TGUI_TextLexer *lexer)
+{
+	this->lexer = lexer;
+	for (size_t i = 0; i < lines.size(); i++) {
+		lines[i].tokens.clear();
+	}
+	lexFrom(0, lines.size()-1);
+}
+
+void TGUI_TextArea::setTextColor(ALLEGRO_COLOR color)
+{
+	textColor = color;
+}
+
+TGUI_TextArea::TGUI_TextArea(const std::string &text, int x, int y, int width, int height) :
+	cursor(0),
+	cursorX(-1),
+	wrap(false),
+	lexer(NULL),
+	minWidth(width),
+	minHeight(height),
+	maxLineWidth(0),
+	layoutFont(NULL),
+	layoutDirty(false),
+	visibleRows(0)
+{
+	setPositionsChildren(false);
+
+	this->x = x;
+	this->y = y;
+	this->width = width;
+	this->height = height;
+
+	textColor = al_map_rgb(0x00, 0x00, 0x00);
+
+	setText(text);
+}
+
+TGUI_TextArea::~TGUI_TextArea()
+{
+}
+
+// --
+
+int TGUI_Frame::barHeight()
+{
+	return tgui::getLineHeight(tgui::getFont()) + TITLE_PADDING*2;
+}
+
+bool TGUI_Frame::getAbsoluteChildPosition(tgui::TGUIWidget *widget, int *x, int *y)
+{
+	if (child == widget) {
+		*x = this->x + widget->getX();
+		*y = this->y + widget->getY();
 		return true;
 	}
 	return false;
@@ -2026,7 +2750,7 @@ bool TGUI_Frame::getAbsoluteChildPosition(tgui::TGUIWidget *widget, int *x, int
 
 void TGUI_Frame::mouseDown(int rel_x, int rel_y, int abs_x, int abs_y, int mb)
 {
-	int top = al_get_font_line_height(tgui::getFont()) + TITLE_PADDING*2;
+	int top = tgui::getLineHeight(tgui::getFont()) + TITLE_PADDING*2;
 
 	if (rel_x >= 0 && rel_y >= 0 && rel_x < width && rel_y < top) {
 		dragging = true;
@@ -2055,6 +2779,7 @@ void TGUI_Frame::mouseMove(int rel_x, int rel_y, int abs_x, int abs_y)
 		if (y > scr_h-height) y = scr_h-height;
 		drag_x = abs_x;
 		drag_y = abs_y;
+		tgui::invalidateBounds();
 	}
 }
 
@@ -2072,11 +2797,11 @@ void TGUI_Frame::draw(int abs_x, int abs_y)
 	al_draw_filled_rectangle(abs_x, abs_y, abs_x+width,
 		abs_y+top, fore);
 
-	al_draw_text(tgui::getFont(), al_map_rgb(0x00, 0x00, 0x00), abs_x+width/2,
-		abs_y+TITLE_PADDING, ALLEGRO_ALIGN_CENTRE, title.c_str());
+	tgui::drawText(tgui::getFont(), al_map_rgb(0x00, 0x00, 0x00), abs_x+width/2,
+		abs_y+TITLE_PADDING, ALLEGRO_ALIGN_CENTRE, title);
 }
 
-TGUI_Frame::TGUI_Frame(std::string title, int x, int y, int width, int height) :
+TGUI_Frame::TGUI_Frame(const std::string &title, int x, int y, int width, int height) :
 	title(title),
 	dragging(false)
 {
@@ -2092,39 +2817,320 @@ TGUI_Frame::~TGUI_Frame()
 
 // --
 
-void TGUI_Label::setText(std::string text)
+const std::string &TGUI_Label::getText()
 {
-	this->text = text;
+	return text;
 }
 
-void TGUI_Label::draw(int abs_x, int abs_y)
+void TGUI_Label::setText(const std::string &text)
 {
-	setDefaultColors();
-
-	al_draw_text(tgui::getFont(), color, abs_x, abs_y, flags, text.c_str());
+	this->text = text;
+	if (wrapWidth > 0)
+		wrappedText.setText(this->text, color);
+	invalidateMeasure();
 }
 
-TGUI_Label::TGUI_Label(std::string text, ALLEGRO_COLOR color, int x, int y, int flags) :
-	text(text),
-	color(color),
-	flags(flags)
+#ifdef TGUI_RVALUE_REFS
+void TGUI_Label::setText(std::string &&text)
 {
+	this->text = std::move(text);
+	if (wrapWidth > 0)
+		wrappedText.setText(this->text, color);
+	invalidateMeasure();
+}
+#endif
+
+void TGUI_Label::measure(int *w, int *h)
+{
+	if (wrapWidth > 0) {
+		*w = wrapWidth;
+		*h = wrappedText.getHeight();
+		return;
+	}
+
+	*w = tgui::getTextWidth(tgui::getFont(), text);
+	*h = tgui::getLineHeight(tgui::getFont());
+}
+
+void TGUI_Label::setWrapWidth(int width)
+{
+	wrapWidth = width;
+	if (wrapWidth > 0) {
+		wrappedText.setText(text, color);
+		wrappedText.setWidth(wrapWidth);
+		wrappedText.setAlignment(flags);
+	}
+	else {
+		wrappedText.clear();
+	}
+	int w, h;
+	measure(&w, &h);
+	this->width = w;
+	this->height = h;
+	tgui::invalidateBounds();
+	invalidateMeasure();
+}
+
+void TGUI_Label::draw(int abs_x, int abs_y)
+{
+	setDefaultColors();
+
+	if (wrapWidth > 0) {
+		// the layout only wraps again when the gui font changes
+		int h = wrappedText.getHeight();
+		if (h != height) {
+			height = h;
+			tgui::invalidateBounds();
+		}
+		wrappedText.draw(abs_x, abs_y);
+		return;
+	}
+
+	tgui::drawText(tgui::getFont(), color, abs_x, abs_y, flags, text);
+}
+
+TGUI_Label::TGUI_Label(const std::string &text, ALLEGRO_COLOR color, int x, int y, int flags) :
+	text(text),
+	color(color),
+	flags(flags),
+	wrapWidth(0)
+{
+	setPositionsChildren(false);
+
 	this->x = x;
 	this->y = y;
-	this->width = al_get_text_width(tgui::getFont(), text.c_str());
-	this->height = al_get_font_line_height(tgui::getFont());
+	this->width = tgui::getTextWidth(tgui::getFont(), text);
+	this->height = tgui::getLineHeight(tgui::getFont());
 }
 
 TGUI_Label::~TGUI_Label()
 {
 }
 
+bool TGUI_DialogueText::acceptsFocus()
+{
+	return true;
+}
+
+void TGUI_DialogueText::draw(int abs_x, int abs_y)
+{
+	setDefaultColors();
+	checkLayout();
+
+	al_draw_filled_rectangle(abs_x, abs_y, abs_x+width, abs_y+height, back);
+	al_draw_rectangle(abs_x+0.5, abs_y+0.5, abs_x+width-0.5, abs_y+height-0.5, fore, 1);
+
+	int x = abs_x + PADDING;
+	int y = abs_y + PADDING - pageTops[page];
+	int start = pageStarts[page];
+	int end = start + (int)shown;
+
+	for (int i = start; i < end; i++) {
+		const tgui::TGUIGlyph &g = glyphs[i];
+		if (g.icon)
+			al_draw_bitmap(g.icon, x+g.x, y+g.y, 0);
+		else if (g.code_point != ' ')
+			al_draw_glyph(g.font, g.color, x+g.x, y+g.y, g.code_point);
+	}
+}
+
+tgui::TGUIWidget *TGUI_DialogueText::update()
+{
+	checkLayout();
+
+	long now = tgui::currentTimeMillis();
+	long elapsed = MIN(now - lastTime, 50);
+	lastTime = now;
+
+	if (!pageShown) {
+		int length = pageLength();
+		if (speed > 0)
+			shown += speed * elapsed / 1000;
+		if (speed <= 0 || shown >= length) {
+			shown = length;
+			pageShown = true;
+			if (pageCallback)
+				pageCallback(this, page);
+		}
+	}
+
+	if (finished) {
+		finished = false;
+		return this;
+	}
+
+	return NULL;
+}
+
+void TGUI_DialogueText::mouseDown(int rel_x, int rel_y, int abs_x, int abs_y, int mb)
+{
+	if (rel_x >= 0 && rel_y >= 0)
+		skip();
+}
+
+bool TGUI_DialogueText::keyChar(int keycode, int unichar)
+{
+	if (this != tgui::getFocussedWidget())
+		return false;
+
+	if (keycode == ALLEGRO_KEY_ENTER || keycode == ALLEGRO_KEY_SPACE) {
+		skip();
+		return true;
+	}
+
+	return false;
+}
+
+// Lays out again after a font or size change, on the same page if it's
+// still there
+void TGUI_DialogueText::checkLayout()
+{
+	if (tgui::getFont() != layoutFont || width != layoutWidth || height != layoutHeight) {
+		paginate();
+		page = MIN(page, getNumPages()-1);
+		shown = MIN(shown, (float)pageLength());
+	}
+}
+
+void TGUI_DialogueText::paginate()
+{
+	layoutFont = tgui::getFont();
+	layoutWidth = width;
+	layoutHeight = height;
+
+	layout.setWidth(MAX(1, width - PADDING*2));
+	glyphs.clear();
+	layout.getGlyphs(glyphs);
+
+	pageStarts.clear();
+	pageTops.clear();
+	pageStarts.push_back(0);
+	pageTops.push_back(0);
+
+	// as many lines as fit, at least one
+	int inner = height - PADDING*2;
+	int lines = layout.getNumLines();
+	int top = 0;
+	int g = 0;
+	for (int l = 1; l < lines; l++) {
+		if (layout.getLineTop(l+1) - top > inner) {
+			top = layout.getLineTop(l);
+			while (g < (int)glyphs.size() && glyphs[g].line < l)
+				g++;
+			pageStarts.push_back(g);
+			pageTops.push_back(top);
+		}
+	}
+
+	pageStarts.push_back(glyphs.size());
+}
+
+void TGUI_DialogueText::showPage(int page)
+{
+	this->page = page;
+	shown = 0;
+	pageShown = false;
+	lastTime = tgui::currentTimeMillis();
+}
+
+int TGUI_DialogueText::pageLength()
+{
+	return pageStarts[page+1] - pageStarts[page];
+}
+
+void TGUI_DialogueText::setText(const std::string &text, ALLEGRO_COLOR color)
+{
+	layout.setText(text, color);
+	restart();
+}
+
+tgui::TGUITextLayout &TGUI_DialogueText::getLayout()
+{
+	return layout;
+}
+
+void TGUI_DialogueText::restart()
+{
+	paginate();
+	showPage(0);
+	finished = false;
+}
+
+void TGUI_DialogueText::setSpeed(float speed)
+{
+	this->speed = speed;
+}
+
+// Shows the rest of the page, or the next page when it's all showing
+void TGUI_DialogueText::skip()
+{
+	checkLayout();
+
+	if (!pageShown) {
+		shown = pageLength();
+		pageShown = true;
+		if (pageCallback)
+			pageCallback(this, page);
+	}
+	else if (page+1 < getNumPages()) {
+		showPage(page+1);
+	}
+	else {
+		finished = true;
+	}
+}
+
+int TGUI_DialogueText::getPage()
+{
+	return page;
+}
+
+int TGUI_DialogueText::getNumPages()
+{
+	return pageStarts.size() - 1;
+}
+
+bool TGUI_DialogueText::isPageShown()
+{
+	return pageShown;
+}
+
+void TGUI_DialogueText::setPageCallback(void (*callback)(TGUI_DialogueText *dialogue, int page))
+{
+	pageCallback = callback;
+}
+
+TGUI_DialogueText::TGUI_DialogueText(const std::string &text, int x, int y, int width, int height) :
+	layoutFont(NULL),
+	page(0),
+	speed(30),
+	finished(false),
+	pageCallback(NULL)
+{
+	setPositionsChildren(false);
+
+	this->x = x;
+	this->y = y;
+	this->width = width;
+	this->height = height;
+
+	setDefaultColors();
+	setText(text, fore);
+}
+
+TGUI_DialogueText::~TGUI_DialogueText()
+{
+}
+
 TGUI_List::TGUI_List(int x, int y, int width)
 {
+	setPositionsChildren(false);
+
 	this->x = x;
 	this->y = y;
 	this->width = width;
 	height = 0;
+	provider = NULL;
 	selected = 0;
 }
 
@@ -2135,9 +3141,9 @@ TGUI_List::~TGUI_List()
 void TGUI_List::mouseDown(int rel_x, int rel_y, int abs_x, int abs_y, int mb)
 {
 	if (rel_y >= 0) {
-		int lh = al_get_font_line_height(tgui::getFont());
+		int lh = tgui::getLineHeight(tgui::getFont());
 		int sel = rel_y / lh;
-		if (sel < 0 || sel >= (int)labels.size()) {
+		if (sel < 0 || sel >= getCount()) {
 			return;
 		}
 		selected = sel;
@@ -2152,26 +3158,737 @@ const std::vector<std::string> &TGUI_List::getLabels()
 void TGUI_List::setLabels(const std::vector<std::string> &labels)
 {
 	this->labels = labels;
-	height = al_get_font_line_height(tgui::getFont()) * labels.size();
+	refresh();
+}
+
+#ifdef TGUI_RVALUE_REFS
+void TGUI_List::setLabels(std::vector<std::string> &&labels)
+{
+	this->labels = std::move(labels);
+	refresh();
+}
+#endif
+
+void TGUI_List::setProvider(TGUI_ListProvider *provider)
+{
+	this->provider = provider;
+	refresh();
+}
+
+void TGUI_List::refresh()
+{
+	height = tgui::getLineHeight(tgui::getFont()) * getCount();
+	tgui::invalidateBounds();
+}
+
+int TGUI_List::getCount()
+{
+	return provider ? provider->getCount() : (int)labels.size();
 }
 
 void TGUI_List::draw(int abs_x, int abs_y)
 {
 	setDefaultColors();
 
-	int lh = al_get_font_line_height(tgui::getFont());
+	const ALLEGRO_FONT *font = tgui::getFont();
+	int lh = tgui::getLineHeight(font);
+
+	int _x, _y, _w, _h;
+	al_get_clipping_rectangle(&_x, &_y, &_w, &_h);
+	tgui::setClippedClip(abs_x, abs_y, width, height);
+
+	// only the rows in the clip, and of them only the glyphs in it
+	int first = 0;
+	int last = getCount();
+	float x1, y1, x2, y2;
+	if (tgui::getLocalClip(&x1, &y1, &x2, &y2)) {
+		first = MAX(0, ((int)y1 - abs_y) / lh);
+		last = MIN(last, ((int)y2 - abs_y) / lh + 1);
+	}
 
-	for (size_t i = 0; i < labels.size(); i++) {
+	for (int i = first; i < last; i++) {
 		ALLEGRO_COLOR fore;
 		ALLEGRO_COLOR back;
 		int yy = abs_y + lh*i;
 		fore = al_map_rgb(0x00, 0x00, 0x00);
-		if ((int)i == selected) {
+		if (i == selected) {
 			back = ::fore;
 			al_draw_filled_rectangle(abs_x, yy, abs_x+width, yy+lh, back);
 		}
-		al_draw_text(tgui::getFont(), fore, abs_x+2, yy, 0, labels[i].c_str());
+		if (provider) {
+			int length;
+			const char *text = provider->getText(i, &length);
+			tgui::drawClippedText(font, fore, abs_x+2, yy, text, length);
+		}
+		else {
+			tgui::drawClippedText(font, fore, abs_x+2, yy, labels[i].c_str(), labels[i].length());
+		}
+	}
+
+	al_set_clipping_rectangle(_x, _y, _w, _h);
+}
+
+// --
+
+void TGUI_Container::draw(int abs_x, int abs_y)
+{
+	int _x, _y, _w, _h;
+	al_get_clipping_rectangle(&_x, &_y, &_w, &_h);
+	tgui::setClip(abs_x, abs_y, width, height);
+
+	for (size_t i = 0; i < widgets.size(); i++) {
+		TGUIWidget *widget = widgets[i];
+		widget->draw(abs_x+widget->getX(), abs_y+widget->getY());
 	}
+
+	al_set_clipping_rectangle(_x, _y, _w, _h);
+}
+
+void TGUI_Container::keyDown(int keycode)
+{
+	for (size_t i = 0; i < widgets.size(); i++) {
+		widgets[i]->keyDown(keycode);
+	}
+}
+
+void TGUI_Container::keyUp(int keycode)
+{
+	for (size_t i = 0; i < widgets.size(); i++) {
+		widgets[i]->keyUp(keycode);
+	}
+}
+
+bool TGUI_Container::keyChar(int keycode, int unichar)
+{
+	bool used = false;
+	for (size_t i = 0; i < widgets.size(); i++) {
+		used = used || widgets[i]->keyChar(keycode, unichar);
+	}
+	return used;
+}
+
+void TGUI_Container::joyButtonDown(int button)
+{
+	for (size_t i = 0; i < widgets.size(); i++) {
+		widgets[i]->joyButtonDown(button);
+	}
+}
+
+void TGUI_Container::joyButtonDownRepeat(int button)
+{
+	for (size_t i = 0; i < widgets.size(); i++) {
+		widgets[i]->joyButtonDownRepeat(button);
+	}
+}
+
+void TGUI_Container::joyButtonUp(int button)
+{
+	for (size_t i = 0; i < widgets.size(); i++) {
+		widgets[i]->joyButtonUp(button);
+	}
+}
+
+void TGUI_Container::joyAxis(int stick, int axis, float value)
+{
+	for (size_t i = 0; i < widgets.size(); i++) {
+		widgets[i]->joyAxis(stick, axis, value);
+	}
+}
+
+bool TGUI_Container::joyAxisRepeat(int stick, int axis, float value)
+{
+	bool used = false;
+	for (size_t i = 0; i < widgets.size(); i++) {
+		used = used || widgets[i]->joyAxisRepeat(stick, axis, value);
+	}
+	return used;
+}
+
+int TGUI_Container::findChild(int rel_x, int rel_y)
+{
+	if (rel_x < 0 || rel_y < 0)
+		return -1;
+
+	for (size_t i = 0; i < widgets.size(); i++) {
+		TGUIWidget *widget = widgets[i];
+		if (rel_x >= widget->getX() &&
+			rel_x <= widget->getX()+widget->getWidth() &&
+			rel_y >= widget->getY() &&
+			rel_y <= widget->getY()+widget->getHeight()) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+// The child under the pointer gets the event, the rest get -1, -1 like
+// TGUI_Splitter sections
+void TGUI_Container::mouseUp(int rel_x, int rel_y, int abs_x, int abs_y, int mb)
+{
+	int hit = findChild(rel_x, rel_y);
+
+	for (int i = 0; i < (int)widgets.size(); i++) {
+		TGUIWidget *widget = widgets[i];
+		if (i == hit) {
+			widget->mouseUp(rel_x-widget->getX(), rel_y-widget->getY(), abs_x, abs_y, mb);
+		}
+		else {
+			widget->mouseUp(-1, -1, abs_x, abs_y, mb);
+		}
+	}
+}
+
+void TGUI_Container::mouseDown(int rel_x, int rel_y, int abs_x, int abs_y, int mb)
+{
+	int hit = findChild(rel_x, rel_y);
+
+	for (int i = 0; i < (int)widgets.size(); i++) {
+		TGUIWidget *widget = widgets[i];
+		if (i == hit) {
+			tgui::setFocus(widget);
+			widget->mouseDown(rel_x-widget->getX(), rel_y-widget->getY(), abs_x, abs_y, mb);
+		}
+		else {
+			widget->mouseDown(-1, -1, abs_x, abs_y, mb);
+		}
+	}
+}
+
+void TGUI_Container::mouseMove(int rel_x, int rel_y, int abs_x, int abs_y)
+{
+	int hit = findChild(rel_x, rel_y);
+
+	for (int i = 0; i < (int)widgets.size(); i++) {
+		TGUIWidget *widget = widgets[i];
+		if (i == hit) {
+			widget->mouseMove(rel_x-widget->getX(), rel_y-widget->getY(), abs_x, abs_y);
+		}
+		else {
+			widget->mouseMove(-1, -1, abs_x, abs_y);
+		}
+	}
+}
+
+tgui::TGUIWidget *TGUI_Container::update()
+{
+	for (size_t i = 0; i < widgets.size(); i++) {
+		TGUIWidget *widget = widgets[i]->update();
+		if (widget)
+			return widget;
+	}
+	return NULL;
+}
+
+bool TGUI_Container::getAbsoluteChildPosition(tgui::TGUIWidget *widget, int *x, int *y)
+{
+	for (size_t i = 0; i < widgets.size(); i++) {
+		if (widgets[i] == widget) {
+			int own_x, own_y;
+			tgui::determineAbsolutePosition(this, &own_x, &own_y);
+			*x = own_x + widget->getX();
+			*y = own_y + widget->getY();
+			return true;
+		}
+	}
+
+	for (size_t i = 0; i < widgets.size(); i++) {
+		if (widgets[i]->getPositionsChildren() &&
+			widgets[i]->getAbsoluteChildPosition(widget, x, y)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void TGUI_Container::addCollidingChildrenToVector(std::vector<tgui::TGUIWidget *> &v, tgui::TGUIWidget *exception, int x1, int y1, int x2, int y2)
+{
+	for (size_t i = 0; i < widgets.size(); i++) {
+		tgui::TGUIWidget *w = widgets[i];
+		w->addCollidingChildrenToVector(v, exception, x1, y1, x2, y2);
+		if (w == exception || !w->acceptsFocus()) {
+			continue;
+		}
+		int wx, wy;
+		tgui::determineAbsolutePosition(w, &wx, &wy);
+		if (tgui::checkBoxCollision(x1, y1, x2, y2, wx, wy, wx+w->getWidth(), wy+w->getHeight())) {
+			v.push_back(w);
+		}
+	}
+}
+
+void TGUI_Container::setWidth(int w)
+{
+	if (w != width) {
+		width = w;
+		tgui::invalidateBounds();
+		invalidateLayout();
+	}
+}
+
+void TGUI_Container::setHeight(int h)
+{
+	if (h != height) {
+		height = h;
+		tgui::invalidateBounds();
+		invalidateLayout();
+	}
+}
+
+std::vector<tgui::TGUIWidget *> &TGUI_Container::getWidgets()
+{
+	return widgets;
+}
+
+void TGUI_Container::addChild(tgui::TGUIWidget *widget)
+{
+	widgets.push_back(widget);
+	widget->setParent(this);
+	invalidateLayout();
+	tgui::invalidateBounds();
+}
+
+void TGUI_Container::removeWidget(tgui::TGUIWidget *widget)
+{
+	for (size_t i = 0; i < widgets.size(); i++) {
+		if (widgets[i] == widget) {
+			widgets.erase(widgets.begin()+i);
+			widget->setParent(NULL);
+			childRemoved(i);
+			invalidateLayout();
+			tgui::invalidateBounds();
+			return;
+		}
+	}
+}
+
+TGUI_Container::TGUI_Container(int x, int y, int w, int h)
+{
+	this->x = x;
+	this->y = y;
+	width = w;
+	height = h;
+}
+
+// --
+
+int TGUI_Flex::findItem(tgui::TGUIWidget *widget)
+{
+	for (size_t i = 0; i < widgets.size(); i++) {
+		if (widgets[i] == widget)
+			return i;
+	}
+	return -1;
+}
+
+int TGUI_Flex::measuredMain(int index)
+{
+	return direction == TGUI_HORIZONTAL ? items[index].measured_w : items[index].measured_h;
+}
+
+int TGUI_Flex::measuredCross(int index)
+{
+	return direction == TGUI_HORIZONTAL ? items[index].measured_h : items[index].measured_w;
+}
+
+float TGUI_Flex::clampSize(int index, float size)
+{
+	const Item &item = items[index];
+
+	if (item.max_size >= 0 && size > item.max_size)
+		size = item.max_size;
+	if (item.min_size >= 0 && size < item.min_size)
+		size = item.min_size;
+	if (size < 0)
+		size = 0;
+
+	return size;
+}
+
+void TGUI_Flex::layoutLine(int first, int end, int cross_pos, int cross_size)
+{
+	int main_size = direction == TGUI_HORIZONTAL ? width : height;
+	int n = end - first;
+
+	line_sizes.resize(n);
+	line_frozen.assign(n, false);
+
+	// Share out the free space by weight. Anything that hits its min/max
+	// is frozen there and the rest is shared again.
+	bool clamped = true;
+	while (clamped) {
+		float free_space = main_size - spacing * (n-1);
+		float total_grow = 0;
+		float total_shrink = 0;
+		for (int i = 0; i < n; i++) {
+			if (line_frozen[i]) {
+				free_space -= line_sizes[i];
+			}
+			else {
+				float base = clampSize(first+i, measuredMain(first+i));
+				free_space -= base;
+				total_grow += items[first+i].grow;
+				total_shrink += items[first+i].shrink * base;
+			}
+		}
+
+		clamped = false;
+		for (int i = 0; i < n; i++) {
+			if (line_frozen[i])
+				continue;
+			const Item &item = items[first+i];
+			float base = clampSize(first+i, measuredMain(first+i));
+			float size = base;
+			if (free_space > 0 && total_grow > 0) {
+				size += free_space * item.grow / total_grow;
+			}
+			else if (free_space < 0 && total_shrink > 0) {
+				size += free_space * item.shrink * base / total_shrink;
+			}
+			line_sizes[i] = clampSize(first+i, size);
+			if (line_sizes[i] != size) {
+				line_frozen[i] = true;
+				clamped = true;
+			}
+		}
+	}
+
+	// Round the running position, not each size, so there are no gaps
+	float pos = 0;
+	for (int i = 0; i < n; i++) {
+		TGUIWidget *widget = widgets[first+i];
+
+		int start = (int)(pos + 0.5f);
+		pos += line_sizes[i];
+		int size = (int)(pos + 0.5f) - start;
+		pos += spacing;
+
+		int cross = MIN(measuredCross(first+i), cross_size);
+		int cross_offset = 0;
+		if (align == TGUI_FLEX_CENTER) {
+			cross_offset = (cross_size - cross) / 2;
+		}
+		else if (align == TGUI_FLEX_END) {
+			cross_offset = cross_size - cross;
+		}
+		else if (align == TGUI_FLEX_STRETCH) {
+			cross = cross_size;
+		}
+
+		if (direction == TGUI_HORIZONTAL) {
+			widget->setX(start);
+			widget->setY(cross_pos + cross_offset);
+			widget->setWidth(size);
+			widget->setHeight(cross);
+		}
+		else {
+			widget->setX(cross_pos + cross_offset);
+			widget->setY(start);
+			widget->setWidth(cross);
+			widget->setHeight(size);
+		}
+	}
+}
+
+void TGUI_Flex::prepareLayout()
+{
+	for (size_t i = 0; i < widgets.size(); i++) {
+		if (widgets[i]->takeMeasurePending()) {
+			widgets[i]->measure(&items[i].measured_w, &items[i].measured_h);
+		}
+	}
+}
+
+void TGUI_Flex::layout()
+{
+	int main_size = direction == TGUI_HORIZONTAL ? width : height;
+	int cross_size = direction == TGUI_HORIZONTAL ? height : width;
+	int n = widgets.size();
+
+	if (!wrap) {
+		layoutLine(0, n, 0, cross_size);
+		return;
+	}
+
+	int cross_pos = 0;
+	int first = 0;
+	while (first < n) {
+		// Take children while their base sizes fit (at least one)
+		int end = first;
+		int used = 0;
+		int line_cross = 0;
+		while (end < n) {
+			int needed = used + (int)clampSize(end, measuredMain(end));
+			if (end > first) {
+				needed += spacing;
+				if (needed > main_size)
+					break;
+			}
+			used = needed;
+			line_cross = MAX(line_cross, measuredCross(end));
+			end++;
+		}
+		layoutLine(first, end, cross_pos, line_cross);
+		cross_pos += line_cross + spacing;
+		first = end;
+	}
+}
+
+void TGUI_Flex::addWidget(tgui::TGUIWidget *widget, float grow, float shrink)
+{
+	Item item;
+	item.grow = grow;
+	item.shrink = shrink;
+	item.min_size = -1;
+	item.max_size = -1;
+	widget->measure(&item.measured_w, &item.measured_h);
+	widget->takeMeasurePending();
+	items.push_back(item);
+
+	addChild(widget);
+}
+
+void TGUI_Flex::setWeights(tgui::TGUIWidget *widget, float grow, float shrink)
+{
+	int i = findItem(widget);
+	if (i >= 0) {
+		items[i].grow = grow;
+		items[i].shrink = shrink;
+		invalidateLayout();
+	}
+}
+
+void TGUI_Flex::setLimits(tgui::TGUIWidget *widget, int min_size, int max_size)
+{
+	int i = findItem(widget);
+	if (i >= 0) {
+		items[i].min_size = min_size;
+		items[i].max_size = max_size;
+		invalidateLayout();
+	}
+}
+
+void TGUI_Flex::setAlign(TGUI_FlexAlign align)
+{
+	this->align = align;
+	invalidateLayout();
+}
+
+void TGUI_Flex::setWrap(bool wrap)
+{
+	this->wrap = wrap;
+	invalidateLayout();
+}
+
+void TGUI_Flex::setSpacing(int spacing)
+{
+	this->spacing = spacing;
+	invalidateLayout();
+}
+
+void TGUI_Flex::childRemoved(int index)
+{
+	items.erase(items.begin()+index);
+}
+
+TGUI_Flex::TGUI_Flex(int x, int y, int w, int h, TGUI_Direction direction) :
+	TGUI_Container(x, y, w, h),
+	direction(direction),
+	align(TGUI_FLEX_START),
+	wrap(false),
+	spacing(0)
+{
+}
+
+// --
+
+void TGUI_Grid::dirtyTracks(const Cell &cell)
+{
+	for (int i = cell.column; i < cell.column+cell.column_span && i < (int)columns.size(); i++) {
+		columns[i].dirty = true;
+	}
+	for (int i = cell.row; i < cell.row+cell.row_span && i < (int)rows.size(); i++) {
+		rows[i].dirty = true;
+	}
+}
+
+void TGUI_Grid::updateNaturalSizes(std::vector<Track> &tracks, bool is_columns)
+{
+	bool any = false;
+	for (size_t i = 0; i < tracks.size(); i++) {
+		if (tracks[i].dirty && tracks[i].type == TGUI_GRID_AUTO) {
+			tracks[i].natural = 0;
+			any = true;
+		}
+	}
+
+	if (any) {
+		for (size_t i = 0; i < cells.size(); i++) {
+			const Cell &cell = cells[i];
+			int t = is_columns ? cell.column : cell.row;
+			int span = is_columns ? cell.column_span : cell.row_span;
+			if (span != 1 || t >= (int)tracks.size()) {
+				continue;
+			}
+			Track &track = tracks[t];
+			if (track.dirty && track.type == TGUI_GRID_AUTO) {
+				track.natural = MAX(track.natural, is_columns ? cell.measured_w : cell.measured_h);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < tracks.size(); i++) {
+		tracks[i].dirty = false;
+	}
+}
+
+void TGUI_Grid::placeTracks(std::vector<Track> &tracks, int total, int gap)
+{
+	if (tracks.size() == 0)
+		return;
+
+	float left = total - gap * ((int)tracks.size()-1);
+	float fractions = 0;
+	for (size_t i = 0; i < tracks.size(); i++) {
+		if (tracks[i].type == TGUI_GRID_FIXED) {
+			left -= tracks[i].value;
+		}
+		else if (tracks[i].type == TGUI_GRID_AUTO) {
+			left -= tracks[i].natural;
+		}
+		else {
+			fractions += tracks[i].value;
+		}
+	}
+	if (left < 0) {
+		left = 0;
+	}
+
+	// Round the running position so tracks meet exactly
+	float pos = 0;
+	for (size_t i = 0; i < tracks.size(); i++) {
+		float size;
+		if (tracks[i].type == TGUI_GRID_FIXED) {
+			size = tracks[i].value;
+		}
+		else if (tracks[i].type == TGUI_GRID_AUTO) {
+			size = tracks[i].natural;
+		}
+		else {
+			size = fractions > 0 ? left * tracks[i].value / fractions : 0;
+		}
+		tracks[i].offset = (int)(pos + 0.5f);
+		pos += size;
+		tracks[i].size = (int)(pos + 0.5f) - tracks[i].offset;
+		pos += gap;
+	}
+}
+
+void TGUI_Grid::prepareLayout()
+{
+	for (size_t i = 0; i < widgets.size(); i++) {
+		if (widgets[i]->takeMeasurePending()) {
+			Cell &cell = cells[i];
+			int w, h;
+			widgets[i]->measure(&w, &h);
+			if (w != cell.measured_w || h != cell.measured_h) {
+				cell.measured_w = w;
+				cell.measured_h = h;
+				dirtyTracks(cell);
+			}
+		}
+	}
+}
+
+void TGUI_Grid::layout()
+{
+	updateNaturalSizes(columns, true);
+	updateNaturalSizes(rows, false);
+
+	placeTracks(columns, width, column_gap);
+	placeTracks(rows, height, row_gap);
+
+	for (size_t i = 0; i < widgets.size(); i++) {
+		const Cell &cell = cells[i];
+		int last_column = MIN(cell.column+cell.column_span, (int)columns.size()) - 1;
+		int last_row = MIN(cell.row+cell.row_span, (int)rows.size()) - 1;
+		if (cell.column > last_column || cell.row > last_row) {
+			// outside the grid
+			widgets[i]->setWidth(0);
+			widgets[i]->setHeight(0);
+			continue;
+		}
+		const Track &c1 = columns[cell.column];
+		const Track &c2 = columns[last_column];
+		const Track &r1 = rows[cell.row];
+		const Track &r2 = rows[last_row];
+		widgets[i]->setX(c1.offset);
+		widgets[i]->setY(r1.offset);
+		widgets[i]->setWidth(c2.offset + c2.size - c1.offset);
+		widgets[i]->setHeight(r2.offset + r2.size - r1.offset);
+	}
+}
+
+void TGUI_Grid::addColumn(TGUI_GridTrackType type, float value)
+{
+	Track track;
+	track.type = type;
+	track.value = value;
+	track.natural = 0;
+	track.dirty = true;
+	track.offset = 0;
+	track.size = 0;
+	columns.push_back(track);
+	invalidateLayout();
+}
+
+void TGUI_Grid::addRow(TGUI_GridTrackType type, float value)
+{
+	Track track;
+	track.type = type;
+	track.value = value;
+	track.natural = 0;
+	track.dirty = true;
+	track.offset = 0;
+	track.size = 0;
+	rows.push_back(track);
+	invalidateLayout();
+}
+
+void TGUI_Grid::setGaps(int column_gap, int row_gap)
+{
+	this->column_gap = column_gap;
+	this->row_gap = row_gap;
+	invalidateLayout();
+}
+
+void TGUI_Grid::addWidget(tgui::TGUIWidget *widget, int column, int row, int column_span, int row_span)
+{
+	Cell cell;
+	cell.column = column;
+	cell.row = row;
+	cell.column_span = column_span;
+	cell.row_span = row_span;
+	widget->measure(&cell.measured_w, &cell.measured_h);
+	widget->takeMeasurePending();
+	cells.push_back(cell);
+	dirtyTracks(cell);
+
+	addChild(widget);
+}
+
+void TGUI_Grid::childRemoved(int index)
+{
+	dirtyTracks(cells[index]);
+	cells.erase(cells.begin()+index);
+}
+
+TGUI_Grid::TGUI_Grid(int x, int y, int w, int h) :
+	TGUI_Container(x, y, w, h),
+	column_gap(0),
+	row_gap(0)
+{
 }
 
 void tguiWidgetsSetColors(ALLEGRO_COLOR f, ALLEGRO_COLOR b)
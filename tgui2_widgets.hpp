@@ -2,6 +2,7 @@
 #define _WIDGETS_H
 
 #include "tgui2.hpp"
+#include "tgui2_text.hpp"
 
 #include <string>
 #include <vector>
@@ -15,6 +16,26 @@ enum TGUI_Direction
 	TGUI_VERTICAL
 };
 
+// getKind() bits of the widgets here. User widgets can use TGUI_KIND_USER
+// and up.
+enum TGUI_Kind
+{
+	TGUI_KIND_SPLITTER = 1 << 0,
+	TGUI_KIND_TEXT_MENU_ITEM = 1 << 1,
+	TGUI_KIND_CHECK_MENU_ITEM = 1 << 2,
+	TGUI_KIND_RADIO_MENU_ITEM = 1 << 3,
+	TGUI_KIND_SUB_MENU_ITEM = 1 << 4,
+	TGUI_KIND_CONTAINER = 1 << 5,
+	TGUI_KIND_FLEX = 1 << 6,
+	TGUI_KIND_GRID = 1 << 7,
+	TGUI_KIND_USER = 1 << 16
+};
+
+static inline bool tguiIsKind(tgui::TGUIWidget *widget, unsigned int kind)
+{
+	return widget && (widget->getKind() & kind);
+}
+
 class TGUI_Extended_Widget : public tgui::TGUIWidget
 {
 public:
@@ -27,21 +48,25 @@ public:
 	void setX(float x) {
 		if (tampering) {
 			this->x = x;
+			tgui::invalidateBounds();
 		}
 	}
 	void setY(float y) {
 		if (tampering) {
 			this->y = y;
+			tgui::invalidateBounds();
 		}
 	}
 	void setWidth(int width) {
 		if (tampering) {
 			this->width = width;
+			tgui::invalidateBounds();
 		}
 	}
 	void setHeight(int height) {
 		if (tampering) {
 			this->height = height;
+			tgui::invalidateBounds();
 		}
 	}
 
@@ -139,34 +164,34 @@ public:
 	void setWidth(int w);
 	void setHeight(int h);
 	void setPadding(int hpadding, int vpadding);
+	unsigned int getKind() {
+		return TGUI_Extended_Widget::getKind() | TGUI_KIND_SPLITTER;
+	}
 
 	TGUI_Splitter(
 		int x, int y,
 		int w, int h,
 		TGUI_Direction dir,
 		bool can_resize,
-		std::vector<tgui::TGUIWidget *> widgets
+		const std::vector<tgui::TGUIWidget *> &widgets
 	);
 
-	virtual ~TGUI_Splitter();
+	virtual ~TGUI_Splitter() {}
 
 protected:
-	class TGUI_DummyWidget : public TGUI_Extended_Widget
-	{
-	public:
-		TGUI_DummyWidget(int x, int y) {
-			this->x = x;
-			this->y = y;
-		}
-		virtual ~TGUI_DummyWidget() {}
-	};
+	void updateOffsets();
+	void getSectionOffset(int section, int *xx, int *yy);
+	void findSections(int rel_x, int rel_y, int *first, int *end);
+	bool inSectionGrip(int section, int rel_x, int rel_y);
+	bool inSectionContent(int section, int rel_x, int rel_y);
+	bool overSectionWidget(int section, int rel_x, int rel_y);
 
 	TGUI_Direction direction;
 	bool weighted_resize;
 
 	std::vector<tgui::TGUIWidget *> widgets;
-	std::vector<TGUI_DummyWidget *> dummies;
 	std::vector<int> sizes;
+	std::vector<int> offsets; // offsets[i] = sum of sizes[0..i), for routing
 	std::vector<float> section_resize_weight;
 	std::vector<bool> section_is_resizable; // 1 less then widgets.size()
 	ALLEGRO_COLOR clear_color;
@@ -193,13 +218,21 @@ public:
 	virtual void mouseDown(int rel_x, int rel_y, int abs_x, int abs_y, int mb);
 	virtual void mouseMove(int rel_x, int rel_y, int abs_x, int abs_y);
 	virtual void mouseMoveAll(tgui::TGUIWidget *leftOut, int abs_x, int abs_y);
+	unsigned int getKind() {
+		return TGUI_Extended_Widget::getKind() | TGUI_KIND_TEXT_MENU_ITEM;
+	}
 
-	TGUI_TextMenuItem(std::string name, int shortcut_keycode);
+	TGUI_TextMenuItem(const std::string &name, int shortcut_keycode);
 	virtual ~TGUI_TextMenuItem() {}
 
 protected:
 	std::string name;
 	int shortcut_keycode;
+	// built once from shortcut_keycode: the key's name, and what goes
+	// left of it ("Ctrl-" alone when the name is one character, so the
+	// keys line up, else "Ctrl-" and the name together)
+	std::string shortcut_key;
+	std::string shortcut_label;
 	bool clicked;
 	bool hover;
 	TGUI_MenuBar *menuBar;
@@ -213,8 +246,11 @@ public:
 
 	bool isChecked();
 	void setChecked(bool checked);
+	unsigned int getKind() {
+		return TGUI_TextMenuItem::getKind() | TGUI_KIND_CHECK_MENU_ITEM;
+	}
 	
-	TGUI_CheckMenuItem(std::string name, int shortcut_keycode, bool checked);
+	TGUI_CheckMenuItem(const std::string &name, int shortcut_keycode, bool checked);
 	virtual ~TGUI_CheckMenuItem() {}
 
 protected:
@@ -233,8 +269,11 @@ public:
 
 	bool isSelected();
 	void setSelected();
+	unsigned int getKind() {
+		return TGUI_TextMenuItem::getKind() | TGUI_KIND_RADIO_MENU_ITEM;
+	}
 
-	TGUI_RadioMenuItem(std::string name, int shortcut_keycode, TGUI_RadioGroup *group, int id);
+	TGUI_RadioMenuItem(const std::string &name, int shortcut_keycode, TGUI_RadioGroup *group, int id);
 	virtual ~TGUI_RadioMenuItem() {}
 
 protected:
@@ -255,8 +294,11 @@ public:
 	TGUI_Splitter *getSubMenu();
 	void setSubMenu(TGUI_Splitter *sub);
 	void setParentSplitter(TGUI_Splitter *splitter);
+	unsigned int getKind() {
+		return TGUI_TextMenuItem::getKind() | TGUI_KIND_SUB_MENU_ITEM;
+	}
 
-	TGUI_SubMenuItem(std::string name, TGUI_Splitter *sub_menu);
+	TGUI_SubMenuItem(const std::string &name, TGUI_Splitter *sub_menu);
 	virtual ~TGUI_SubMenuItem() {}
 
 protected:
@@ -280,8 +322,8 @@ public:
 
 	TGUI_MenuBar(
 		int x, int y, int w, int h,
-		std::vector<std::string> menu_names,
-		std::vector<TGUI_Splitter *> menus
+		const std::vector<std::string> &menu_names,
+		const std::vector<TGUI_Splitter *> &menus
 	);
 protected:
 	void setSubMenuSplitters(TGUI_Splitter *root);
@@ -291,7 +333,7 @@ protected:
 	std::vector<TGUI_Splitter *> menus;
 	TGUI_Splitter *open_menu;
 	bool close_menu;
-	tgui::TGUIWidget *itemToReturn;
+	tgui::TGUIHandle itemToReturn;
 };
 
 class TGUI_ScrollPane : public TGUI_Extended_Widget
@@ -366,12 +408,17 @@ public:
 	bool acceptsFocus();
 	void draw(int abs_x, int abs_y);
 
-	TGUI_Button(std::string text, int x, int y, int w, int h);
+	TGUI_Button(const std::string &text, int x, int y, int w, int h);
 
 protected:
 	std::string text;
 };
 	
+// Checks an edit: text is the new text and [start, end) the bytes the
+// edit put in (empty for a deletion), so only those need looking at.
+// Return false to reject the edit.
+typedef bool (*TGUI_TextValidator)(const tgui::TGUIGapBuffer &text, int start, int end);
+
 class TGUI_TextField : public TGUI_Extended_Widget
 {
 public:
@@ -380,22 +427,167 @@ public:
 	bool acceptsFocus();
 	void draw(int abs_x, int abs_y);
 	bool keyChar(int keycode, int unichar);
+	void mouseDown(int rel_x, int rel_y, int abs_x, int abs_y, int mb);
 
+	// Whole-text validator, run on every insert. Prefer setEditValidator.
+	void setValidator(bool (*validate)(const std::string &str));
+	// Deprecated: the text is copied again for each call
 	void setValidator(bool (*validate)(const std::string str));
+	void setEditValidator(TGUI_TextValidator validator);
 	bool isValid();
+	// UTF-8
 	std::string getText();
-	void setText(std::string s);
-
-	TGUI_TextField(std::string startStr, int x, int y, int width);
+	// into text, reusing its storage
+	void getText(std::string &text);
+	void setText(const std::string &s);
+	// Replaces code points [start, end) with s as one edit (one
+	// validation) and puts the cursor after it. false if rejected.
+	bool replaceText(int start, int end, const std::string &s);
+	// at the cursor, e.g. for pasting
+	bool insertText(const std::string &s);
+
+	TGUI_TextField(const std::string &startStr, int x, int y, int width);
 	virtual ~TGUI_TextField();
 
 protected:
+	void updateMetrics(int from);
+	void checkMetrics();
+	int findCursor(int x);
 	void findOffset();
+	bool acceptEdit(int start, int end);
 
-	std::string str;
+	tgui::TGUIGapBuffer buffer;
+	// cursorPos and offset (first visible) count code points
 	int cursorPos;
 	int offset;
-	bool (*validate)(const std::string str);
+	// Byte offset and x of each code point plus one past the end, valid
+	// for metricsFont. Edits redo them from the edited code point on.
+	std::vector<int> starts;
+	std::vector<int> prefix;
+	const ALLEGRO_FONT *metricsFont;
+	bool (*validate)(const std::string &str);
+	bool (*validateCopy)(const std::string str);
+	TGUI_TextValidator editValidator;
+	// the text for validate, reused between edits
+	std::string validateText;
+};
+
+// A run of one colour in a line, from a TGUI_TextLexer
+struct TGUI_TextToken {
+	int start; // byte in the line
+	int length;
+	ALLEGRO_COLOR color;
+};
+
+// Syntax colouring for TGUI_TextArea. lexLine splits one line (without
+// its newline) into tokens; state is what carries over from the end of
+// the line before (0 for the first line, e.g. "in a block comment") and
+// it returns the state at the end of this one. After an edit, lines are
+// lexed again from the edit on until one ends in the same state as
+// before. Bytes not in a token are drawn in the text colour.
+class TGUI_TextLexer {
+public:
+	virtual int lexLine(const char *text, int length, int state, std::vector<TGUI_TextToken> &tokens) = 0;
+	virtual ~TGUI_TextLexer() {}
+};
+
+// Multi-line editor for long texts. The text is a piece table and each
+// line keeps its start, width, wrap points and tokens, so an edit only
+// measures and lexes the lines it touched. The widget grows to fit its
+// text (it's never smaller than it was made) and only lines inside the
+// clipping rectangle are drawn, so put big texts in a TGUI_ScrollPane.
+class TGUI_TextArea : public TGUI_Extended_Widget
+{
+public:
+	static const int PADDING = 3;
+	// spaces a tab becomes
+	static const int TAB_SPACES = 4;
+
+	bool acceptsFocus();
+	void draw(int abs_x, int abs_y);
+	tgui::TGUIWidget *update();
+	bool keyChar(int keycode, int unichar);
+	void mouseDown(int rel_x, int rel_y, int abs_x, int abs_y, int mb);
+	// With wrapping on the text is wrapped again at the next update() or
+	// draw(), as this can be called from layout() on a worker thread
+	void setWidth(int width);
+	void setHeight(int height);
+
+	// UTF-8, lines end in '\n'. Text set or inserted has its tabs turned
+	// to TAB_SPACES spaces and other control characters ('\r' too)
+	// dropped, since the cursor goes by glyph advances.
+	std::string getText();
+	void getText(std::string &text);
+	void setText(const std::string &s);
+	// Replaces bytes [start, end) with s and puts the cursor after it
+	void replaceText(int start, int end, const std::string &s);
+	// at the cursor
+	void insertText(const std::string &s);
+	int getNumLines();
+	std::string getLine(int line);
+	// byte offset in the text
+	int getCursor();
+	void setCursor(int pos);
+	// wrap lines at the widget's width
+	void setWrap(bool wrap);
+	// NULL for none. Not destroyed by the widget.
+	void setLexer(TGUI_TextLexer *lexer);
+	void setTextColor(ALLEGRO_COLOR color);
+
+	TGUI_TextArea(const std::string &text, int x, int y, int width, int height);
+	virtual ~TGUI_TextArea();
+
+protected:
+	struct Line {
+		int start; // byte in the text
+		int width;
+		int row; // first row on screen, counting wrapped rows
+		int lexState; // at the end of the line
+		// bytes in the line where wrapped rows start
+		std::vector<int> breaks;
+		std::vector<TGUI_TextToken> tokens;
+	};
+
+	static bool rowBefore(int row, const Line &line);
+	static bool startBefore(int pos, const Line &line);
+
+	int lineEnd(int line);
+	int numRows(int line);
+	int rowStart(int line, int row);
+	int rowEnd(int line, int row);
+	int findLine(int pos);
+	int findRowLine(int row);
+	int cursorRow(int *line);
+	int byteAtX(int line, int row, int x);
+	int cursorXInRow();
+	int advanceRange(const ALLEGRO_FONT *font, int start, int end);
+	float drawRange(const ALLEGRO_FONT *font, ALLEGRO_COLOR color, float x, float y, int start, int end, float right);
+
+	void splitLines(int first, int last, int end);
+	void layoutLine(int line);
+	void layoutAll();
+	void updateRows(int from);
+	void lexFrom(int first, int last);
+	void updateSize();
+	void checkLayout();
+	void moveVertically(int rows);
+
+	tgui::TGUIPieceTable text;
+	std::vector<Line> lines;
+	int cursor;
+	// x the cursor is kept at going up and down, -1 to take it from
+	// the cursor
+	int cursorX;
+	bool wrap;
+	TGUI_TextLexer *lexer;
+	ALLEGRO_COLOR textColor;
+	int minWidth;
+	int minHeight;
+	int maxLineWidth;
+	const ALLEGRO_FONT *layoutFont;
+	bool layoutDirty;
+	// rows inside the clip at the last draw(), for page up/down
+	int visibleRows;
 };
 
 // only need modal frame right now so this one won't be draggable (yet)
@@ -412,7 +604,7 @@ public:
 
 	int barHeight();
 
-	TGUI_Frame(std::string title, int x, int y, int width, int height);
+	TGUI_Frame(const std::string &title, int x, int y, int width, int height);
 	virtual ~TGUI_Frame();
 
 protected:
@@ -427,9 +619,17 @@ class TGUI_Label : public TGUI_Extended_Widget
 public:
 	void draw(int abs_x, int abs_y);
 
-	void setText(std::string text);
-
-	TGUI_Label(std::string text, ALLEGRO_COLOR color, int x, int y, int flags);
+	const std::string &getText();
+	void setText(const std::string &text);
+#ifdef TGUI_RVALUE_REFS
+	void setText(std::string &&text);
+#endif
+	void measure(int *w, int *h);
+	// Wrap at width pixels (0 for one line, the default). The label is
+	// then that wide and flags align the lines inside it.
+	void setWrapWidth(int width);
+
+	TGUI_Label(const std::string &text, ALLEGRO_COLOR color, int x, int y, int flags);
 	virtual ~TGUI_Label();
 
 protected:
@@ -437,8 +637,84 @@ protected:
 	std::string text;
 	ALLEGRO_COLOR color;
 	int flags;
+	int wrapWidth;
+	// text laid out at wrapWidth, filled only while wrapping
+	tgui::TGUITextLayout wrappedText;
+};
+
+// Dialogue box text that appears a character at a time. The whole text
+// is laid out once (wrapped, split into pages that fit the box, every
+// glyph placed) and a frame only draws the glyphs shown so far on the
+// current page, so a long text costs no more per frame than a short one.
+// The reveal runs off tgui::currentTimeMillis() in update(). A click or
+// Enter/Space shows the rest of the page, or goes to the next page when
+// it's all showing; update() returns the widget once after the last.
+class TGUI_DialogueText : public TGUI_Extended_Widget
+{
+public:
+	static const int PADDING = 6;
+
+	bool acceptsFocus();
+	void draw(int abs_x, int abs_y);
+	tgui::TGUIWidget *update();
+	void mouseDown(int rel_x, int rel_y, int abs_x, int abs_y, int mb);
+	bool keyChar(int keycode, int unichar);
+
+	void setText(const std::string &text, ALLEGRO_COLOR color);
+	// For spans and icons: change it, then call restart()
+	tgui::TGUITextLayout &getLayout();
+	void restart();
+	// characters per second, 0 for whole pages at once
+	void setSpeed(float speed);
+	void skip();
+	int getPage();
+	int getNumPages();
+	bool isPageShown();
+	// called from update() as each page finishes showing
+	void setPageCallback(void (*callback)(TGUI_DialogueText *dialogue, int page));
+
+	TGUI_DialogueText(const std::string &text, int x, int y, int width, int height);
+	virtual ~TGUI_DialogueText();
+
+protected:
+	void checkLayout();
+	void paginate();
+	void showPage(int page);
+	int pageLength();
+
+	tgui::TGUITextLayout layout;
+	std::vector<tgui::TGUIGlyph> glyphs;
+	// first glyph of each page and one past the last, and the y each
+	// page starts at
+	std::vector<int> pageStarts;
+	std::vector<int> pageTops;
+	const ALLEGRO_FONT *layoutFont;
+	int layoutWidth;
+	int layoutHeight;
+
+	int page;
+	float shown; // glyphs of the page
+	float speed;
+	long lastTime;
+	bool pageShown;
+	bool finished;
+	void (*pageCallback)(TGUI_DialogueText *dialogue, int page);
 };
 
+// Rows for a TGUI_List that aren't kept in it. getText is only asked for
+// rows being drawn, and what it returns only has to stay valid until the
+// next call (it can point into the app's own data).
+class TGUI_ListProvider {
+public:
+	virtual int getCount() = 0;
+	// length in bytes, -1 if nul terminated
+	virtual const char *getText(int index, int *length) = 0;
+	virtual ~TGUI_ListProvider() {}
+};
+
+// Rows of text, one selectable. The list is as tall as all its rows and
+// only draws (and measures) the ones inside the clipping rectangle, so
+// long lists go in a TGUI_ScrollPane.
 class TGUI_List : public TGUI_Extended_Widget
 {
 public:
@@ -446,6 +722,15 @@ public:
 
 	const std::vector<std::string> &getLabels();
 	void setLabels(const std::vector<std::string> &labels);
+#ifdef TGUI_RVALUE_REFS
+	void setLabels(std::vector<std::string> &&labels);
+#endif
+	// Rows from provider instead of the labels (NULL to go back to them).
+	// The list doesn't own it. Call refresh() when its count changes.
+	void setProvider(TGUI_ListProvider *provider);
+	TGUI_ListProvider *getProvider() { return provider; }
+	void refresh();
+	int getCount();
 	void mouseDown(int rel_x, int rel_y, int abs_x, int abs_y, int mb);
 
 	int getSelected() { return selected; }
@@ -457,9 +742,179 @@ public:
 protected:
 
 	std::vector<std::string> labels;
+	TGUI_ListProvider *provider;
 	int selected;
 };
 
+// Base for containers that hold a list of children and place them from
+// layout(). Like TGUI_Splitter's sections, the children aren't added to
+// the gui; the container draws them and routes input to them. A child's
+// x/y is its position inside the container.
+class TGUI_Container : public TGUI_Extended_Widget
+{
+public:
+	void draw(int abs_x, int abs_y);
+	void keyDown(int keycode);
+	void keyUp(int keycode);
+	bool keyChar(int keycode, int unichar);
+	void joyButtonDown(int button);
+	void joyButtonDownRepeat(int button);
+	void joyButtonUp(int button);
+	void joyAxis(int stick, int axis, float value);
+	bool joyAxisRepeat(int stick, int axis, float value);
+	void mouseUp(int rel_x, int rel_y, int abs_x, int abs_y, int mb);
+	void mouseDown(int rel_x, int rel_y, int abs_x, int abs_y, int mb);
+	void mouseMove(int rel_x, int rel_y, int abs_x, int abs_y);
+	tgui::TGUIWidget *update();
+	bool getAbsoluteChildPosition(tgui::TGUIWidget *child, int *x, int *y);
+	void addCollidingChildrenToVector(std::vector<tgui::TGUIWidget *> &v, tgui::TGUIWidget *exception, int x1, int y1, int x2, int y2);
+	unsigned int getKind() {
+		return TGUI_Extended_Widget::getKind() | TGUI_KIND_CONTAINER;
+	}
+
+	void setWidth(int w);
+	void setHeight(int h);
+
+	std::vector<tgui::TGUIWidget *> &getWidgets();
+	void removeWidget(tgui::TGUIWidget *widget);
+
+	TGUI_Container(int x, int y, int w, int h);
+	virtual ~TGUI_Container() {}
+
+protected:
+	void addChild(tgui::TGUIWidget *widget);
+	// called by removeWidget so subclasses can drop per-child data
+	virtual void childRemoved(int index) {}
+	// child under rel_x/rel_y (container relative) or -1
+	int findChild(int rel_x, int rel_y);
+
+	std::vector<tgui::TGUIWidget *> widgets;
+};
+
+enum TGUI_FlexAlign
+{
+	TGUI_FLEX_START = 0,
+	TGUI_FLEX_CENTER,
+	TGUI_FLEX_END,
+	TGUI_FLEX_STRETCH
+};
+
+// Lays children out in a row (TGUI_HORIZONTAL) or column (TGUI_VERTICAL),
+// starting from their measured size. Leftover space is shared by grow
+// weight, a shortfall by shrink weight times size, within each child's
+// min/max. With wrapping on, children that don't fit start a new line.
+// Measured sizes are cached and only taken again for children that
+// called invalidateMeasure().
+class TGUI_Flex : public TGUI_Container
+{
+public:
+	// measuring can use the font, so it's done here
+	void prepareLayout();
+	void layout();
+	unsigned int getKind() {
+		return TGUI_Container::getKind() | TGUI_KIND_FLEX;
+	}
+
+	void addWidget(tgui::TGUIWidget *widget, float grow = 0.0f, float shrink = 1.0f);
+	void setWeights(tgui::TGUIWidget *widget, float grow, float shrink);
+	// main axis size limits, -1 for none
+	void setLimits(tgui::TGUIWidget *widget, int min_size, int max_size);
+	// cross axis alignment
+	void setAlign(TGUI_FlexAlign align);
+	void setWrap(bool wrap);
+	void setSpacing(int spacing);
+
+	TGUI_Flex(int x, int y, int w, int h, TGUI_Direction direction);
+	virtual ~TGUI_Flex() {}
+
+protected:
+	struct Item {
+		float grow;
+		float shrink;
+		int min_size;
+		int max_size;
+		int measured_w;
+		int measured_h;
+	};
+
+	void childRemoved(int index);
+	int findItem(tgui::TGUIWidget *widget);
+	int measuredMain(int index);
+	int measuredCross(int index);
+	float clampSize(int index, float size);
+	void layoutLine(int first, int end, int cross_pos, int cross_size);
+
+	TGUI_Direction direction;
+	TGUI_FlexAlign align;
+	bool wrap;
+	int spacing;
+
+	std::vector<Item> items;
+	// scratch for layoutLine
+	std::vector<float> line_sizes;
+	std::vector<bool> line_frozen;
+};
+
+enum TGUI_GridTrackType
+{
+	TGUI_GRID_FIXED = 0, // value is the size in pixels
+	TGUI_GRID_AUTO,      // as big as the largest single-span child
+	TGUI_GRID_FRACTION   // value is a share of the space left over
+};
+
+// Places children in cells of a grid of column and row tracks. A child
+// fills its cell, or the block of cells it spans. The natural size of
+// auto tracks is cached and only worked out again when a child in that
+// track is added, removed or measures differently.
+class TGUI_Grid : public TGUI_Container
+{
+public:
+	// measuring can use the font, so it's done here
+	void prepareLayout();
+	void layout();
+	unsigned int getKind() {
+		return TGUI_Container::getKind() | TGUI_KIND_GRID;
+	}
+
+	void addColumn(TGUI_GridTrackType type, float value = 1.0f);
+	void addRow(TGUI_GridTrackType type, float value = 1.0f);
+	void setGaps(int column_gap, int row_gap);
+	void addWidget(tgui::TGUIWidget *widget, int column, int row, int column_span = 1, int row_span = 1);
+
+	TGUI_Grid(int x, int y, int w, int h);
+	virtual ~TGUI_Grid() {}
+
+protected:
+	struct Track {
+		TGUI_GridTrackType type;
+		float value;
+		int natural; // cached, auto tracks only
+		bool dirty;
+		int offset;
+		int size;
+	};
+
+	struct Cell {
+		int column;
+		int row;
+		int column_span;
+		int row_span;
+		int measured_w;
+		int measured_h;
+	};
+
+	void childRemoved(int index);
+	void dirtyTracks(const Cell &cell);
+	void updateNaturalSizes(std::vector<Track> &tracks, bool is_columns);
+	void placeTracks(std::vector<Track> &tracks, int total, int gap);
+
+	std::vector<Track> columns;
+	std::vector<Track> rows;
+	std::vector<Cell> cells;
+	int column_gap;
+	int row_gap;
+};
+
 void tguiWidgetsSetColors(ALLEGRO_COLOR fore, ALLEGRO_COLOR back);
 void tguiWidgetsGetColors(ALLEGRO_COLOR *fore, ALLEGRO_COLOR *back);
 